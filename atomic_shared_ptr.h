@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cassert>
+#include <shared_ptr.h>
+#include <split_count_word.h>
+
+// Lock-free atomic shared_ptr, the strong counterpart of atomic_weak_ptr,
+// built on split reference counting, see split_count_word.h.
+//
+// Only shared_ptrs whose get() is the address the control block was
+// created with can be stored, since the object address is recovered from
+// the control block. Storing an aliased shared_ptr, or one converted to a
+// base class at a nonzero offset, is a precondition violation, caught by an
+// assert in debug builds.
+template <typename T>
+struct atomic_shared_ptr {
+  static constexpr bool is_always_lock_free = split_count_word<shared_references>::is_always_lock_free;
+
+  // constructors
+  constexpr atomic_shared_ptr() noexcept = default;
+
+  atomic_shared_ptr(shared_ptr<T> desired) noexcept : word(take(desired)) {}
+
+  atomic_shared_ptr(const atomic_shared_ptr&) = delete;
+  atomic_shared_ptr& operator=(const atomic_shared_ptr&) = delete;
+
+  // operations
+  shared_ptr<T> load() const noexcept {
+    return adopt(word.load());
+  }
+
+  void store(shared_ptr<T> desired) noexcept {
+    word.store(take(desired));
+  }
+
+  shared_ptr<T> exchange(shared_ptr<T> desired) noexcept {
+    return adopt(word.exchange(take(desired)));
+  }
+
+  // shared_ptrs compare equal when they share a control block; on failure
+  // expected receives the current value
+  bool compare_exchange_strong(shared_ptr<T>& expected, shared_ptr<T> desired) noexcept {
+    if (word.compare_exchange(expected.control, take(desired))) {
+      return true;
+    }
+    expected = load();
+    return false;
+  }
+
+  bool compare_exchange_weak(shared_ptr<T>& expected, shared_ptr<T> desired) noexcept {
+    return compare_exchange_strong(expected, std::move(desired));
+  }
+
+  operator shared_ptr<T>() const noexcept {
+    return load();
+  }
+
+  atomic_shared_ptr& operator=(shared_ptr<T> desired) noexcept {
+    store(std::move(desired));
+    return *this;
+  }
+
+ private:
+  // moves the strong reference owned by desired out
+  static control_block* take(shared_ptr<T>& desired) noexcept {
+    assert((desired.control == nullptr ||
+            static_cast<const volatile void*>(desired.ptr) == desired.control->get_object()) &&
+           "atomic_shared_ptr cannot store an aliased shared_ptr");
+    desired.ptr = nullptr;
+    return std::exchange(desired.control, nullptr);
+  }
+
+  static shared_ptr<T> adopt(control_block* c) noexcept {
+    return c == nullptr ? shared_ptr<T>() : shared_ptr<T>::adopt(c, static_cast<T*>(c->get_object()));
+  }
+
+  split_count_word<shared_references> word;
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <shared_ptr.h>
+#include <split_count_word.h>
+
+// Lock-free atomic weak_ptr built on split reference counting, see
+// split_count_word.h.
+//
+// Like compact_weak_ptr only non-aliased weak_ptrs can be stored, since the
+// object address is recovered from the control block; storing any other
+// weak_ptr stores an empty one.
+template <typename T>
+struct atomic_weak_ptr {
+  static constexpr bool is_always_lock_free = split_count_word<weak_references>::is_always_lock_free;
+
+  // constructors
+  constexpr atomic_weak_ptr() noexcept = default;
+
+  atomic_weak_ptr(weak_ptr<T> desired) noexcept : word(take(desired)) {}
+
+  atomic_weak_ptr(const atomic_weak_ptr&) = delete;
+  atomic_weak_ptr& operator=(const atomic_weak_ptr&) = delete;
+
+  // operations
+  weak_ptr<T> load() const noexcept {
+    return adopt(word.load());
+  }
+
+  void store(weak_ptr<T> desired) noexcept {
+    word.store(take(desired));
+  }
+
+  weak_ptr<T> exchange(weak_ptr<T> desired) noexcept {
+    return adopt(word.exchange(take(desired)));
+  }
+
+  // weak_ptrs compare equal when they share a control block; on failure
+  // expected receives the current value
+  bool compare_exchange_strong(weak_ptr<T>& expected, weak_ptr<T> desired) noexcept {
+    if (word.compare_exchange(expected.control, take(desired))) {
+      return true;
+    }
+    expected = load();
+    return false;
+  }
+
+  bool compare_exchange_weak(weak_ptr<T>& expected, weak_ptr<T> desired) noexcept {
+    return compare_exchange_strong(expected, std::move(desired));
+  }
+
+  operator weak_ptr<T>() const noexcept {
+    return load();
+  }
+
+  atomic_weak_ptr& operator=(weak_ptr<T> desired) noexcept {
+    store(std::move(desired));
+    return *this;
+  }
+
+ private:
+  // moves the weak reference owned by desired out, or leaves it in desired
+  // and gives null if desired is aliased
+  static control_block* take(weak_ptr<T>& desired) noexcept {
+    if (desired.control == nullptr ||
+        static_cast<const volatile void*>(desired.ptr) != desired.control->get_object()) {
+      return nullptr;
+    }
+    desired.ptr = nullptr;
+    return std::exchange(desired.control, nullptr);
+  }
+
+  static weak_ptr<T> adopt(control_block* c) noexcept {
+    return c == nullptr ? weak_ptr<T>() : weak_ptr<T>::adopt(c, static_cast<T*>(c->get_object()));
+  }
+
+  split_count_word<weak_references> word;
+};
@@ -0,0 +1,990 @@
+#include <algorithm>
+#include <atomic>
+#include <barrier>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "shared_ptr.h"
+#include "weighted_ptr.h"
+#include "compact_weak_ptr.h"
+#include "pointer_algorithms.h"
+#include "cycle_collector.h"
+#include "lru_cache.h"
+#include "future.h"
+#include "lazy_shared.h"
+#include "event_signal.h"
+#include "hamt.h"
+#include "slot_map.h"
+#include "column_table.h"
+
+namespace
+{
+    template <typename F>
+    void measure(char const* name, size_t operations, F&& f)
+    {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        std::printf("%-48s %10.2f ns/op\n", name, elapsed.count() / operations);
+    }
+
+    size_t const fanout_threads = 4;
+    size_t const fanout_copies = 1 << 20;
+
+    // one producer hands a copy of the same handle to every consumer slot,
+    // then the consumers drop their copies concurrently
+    template <typename Ptr>
+    void fanout(Ptr& source)
+    {
+        std::vector<std::vector<Ptr>> slots(fanout_threads);
+        for (auto& s : slots)
+            s.reserve(fanout_copies / fanout_threads);
+
+        Ptr local = source;
+        for (size_t i = 0; i != fanout_copies; ++i)
+            slots[i % fanout_threads].emplace_back(local);
+
+        std::vector<std::thread> consumers;
+        for (auto& s : slots)
+            consumers.emplace_back([&s] { s.clear(); });
+        for (auto& t : consumers)
+            t.join();
+    }
+
+    void bench_fanout()
+    {
+        shared_ptr<int> p = make_shared<int>(42);
+        measure("fanout/shared_ptr", fanout_copies, [&] { fanout(p); });
+
+        weighted_ptr<int> w(p);
+        measure("fanout/weighted_ptr", fanout_copies, [&] { fanout(w); });
+    }
+
+    size_t const expire_objects = 1 << 20;
+
+    void bench_expire_callbacks()
+    {
+        measure("expire/no_callbacks", expire_objects, [] {
+            for (size_t i = 0; i != expire_objects; ++i)
+            {
+                shared_ptr<int> p = make_shared<int>(42);
+            }
+        });
+
+        size_t fired = 0;
+        measure("expire/one_callback", expire_objects, [&] {
+            for (size_t i = 0; i != expire_objects; ++i)
+            {
+                shared_ptr<int> p = make_shared<int>(42);
+                on_expire(p, [&fired] { ++fired; });
+            }
+        });
+    }
+
+    struct position
+    {
+        double x, y, z;
+    };
+
+    struct velocity
+    {
+        double dx, dy, dz;
+    };
+
+    struct health
+    {
+        int points;
+    };
+
+    struct entity
+    {
+        shared_ptr<position> pos;
+        shared_ptr<velocity> vel;
+        shared_ptr<health> hp;
+    };
+
+    size_t const entity_count = 1 << 18;
+
+    template <typename Create>
+    void entity_cycle(char const* name, Create create)
+    {
+        std::vector<entity> entities;
+        entities.reserve(entity_count);
+        measure((std::string(name) + "/create").c_str(), entity_count, [&] {
+            for (size_t i = 0; i != entity_count; ++i)
+                entities.push_back(create(i));
+        });
+
+        double sum = 0;
+        measure((std::string(name) + "/traverse").c_str(), entity_count, [&] {
+            for (auto const& e : entities)
+            {
+                e.pos->x += e.vel->dx;
+                sum += e.pos->x * e.hp->points;
+            }
+        });
+
+        measure((std::string(name) + "/destroy").c_str(), entity_count, [&] { entities.clear(); });
+        if (sum == 42)
+            std::printf("\n");
+    }
+
+    void bench_entity_group()
+    {
+        entity_cycle("entity/separate", [](size_t i) {
+            double d = static_cast<double>(i);
+            return entity{make_shared<position>(position{d, d, d}), make_shared<velocity>(velocity{1, 1, 1}),
+                          make_shared<health>(health{100})};
+        });
+        entity_cycle("entity/group", [](size_t i) {
+            double d = static_cast<double>(i);
+            auto [pos, vel, hp] = make_shared_group<position, velocity, health>(
+                std::make_tuple(position{d, d, d}), std::make_tuple(velocity{1, 1, 1}), std::make_tuple(health{100}));
+            return entity{std::move(pos), std::move(vel), std::move(hp)};
+        });
+    }
+
+    struct message_header
+    {
+        uint32_t id;
+        uint32_t length;
+    };
+
+    struct vector_message
+    {
+        message_header header;
+        std::vector<char> body;
+    };
+
+    size_t const message_count = 1 << 20;
+    size_t const message_body = 64;
+
+    void bench_trailing_message()
+    {
+        std::vector<shared_ptr<vector_message>> separate;
+        separate.reserve(message_count);
+        measure("message/separate_body", message_count, [&] {
+            for (size_t i = 0; i != message_count; ++i)
+            {
+                auto m = make_shared<vector_message>();
+                m->header = {static_cast<uint32_t>(i), static_cast<uint32_t>(message_body)};
+                m->body.assign(message_body, 'x');
+                separate.push_back(std::move(m));
+            }
+            separate.clear();
+        });
+
+        std::vector<shared_ptr<message_header>> fused;
+        fused.reserve(message_count);
+        measure("message/trailing_body", message_count, [&] {
+            for (size_t i = 0; i != message_count; ++i)
+            {
+                auto m = make_shared_with_trailing<message_header, char>(
+                    message_body, message_header{static_cast<uint32_t>(i), static_cast<uint32_t>(message_body)});
+                std::fill(m.trailing.begin(), m.trailing.end(), 'x');
+                fused.push_back(std::move(m.header));
+            }
+            fused.clear();
+        });
+    }
+
+    size_t const pipeline_buffers = 1 << 18;
+    size_t const pipeline_buffer_size = 4096;
+    size_t const pipeline_depth = 8;
+
+    // buffers travel through a bounded queue of in-flight stages; the sink
+    // either drops its reference or recycles buffers it owns alone
+    template <typename Acquire, typename Sink>
+    void pipeline(Acquire acquire, Sink sink)
+    {
+        std::vector<shared_ptr<std::vector<char>>> in_flight;
+        for (size_t i = 0; i != pipeline_buffers; ++i)
+        {
+            shared_ptr<std::vector<char>> buffer = acquire();
+            (*buffer)[i % pipeline_buffer_size] = static_cast<char>(i);
+            in_flight.push_back(std::move(buffer));
+            if (in_flight.size() == pipeline_depth)
+            {
+                for (auto& b : in_flight)
+                    sink(std::move(b));
+                in_flight.clear();
+            }
+        }
+    }
+
+    void bench_buffer_recycling()
+    {
+        measure("pipeline/allocate", pipeline_buffers, [] {
+            pipeline([] { return make_shared<std::vector<char>>(pipeline_buffer_size); },
+                     [](shared_ptr<std::vector<char>>&& b) { b.reset(); });
+        });
+
+        std::vector<unique_shared_ptr<std::vector<char>>> pool;
+        measure("pipeline/try_take_unique", pipeline_buffers, [&] {
+            pipeline(
+                [&] {
+                    if (pool.empty())
+                        return make_shared<std::vector<char>>(pipeline_buffer_size);
+                    shared_ptr<std::vector<char>> b = std::move(pool.back());
+                    pool.pop_back();
+                    return b;
+                },
+                [&](shared_ptr<std::vector<char>>&& b) {
+                    if (auto u = try_take_unique(std::move(b)))
+                        pool.push_back(std::move(u));
+                });
+        });
+    }
+
+    size_t const emplace_iterations = 1 << 22;
+
+    void bench_reset_emplace()
+    {
+        shared_ptr<std::pair<size_t, double>> p = make_shared<std::pair<size_t, double>>();
+        measure("emplace/make_shared", emplace_iterations, [&] {
+            for (size_t i = 0; i != emplace_iterations; ++i)
+                p = make_shared<std::pair<size_t, double>>(i, 1.0);
+        });
+        measure("emplace/reset_emplace", emplace_iterations, [&] {
+            for (size_t i = 0; i != emplace_iterations; ++i)
+                p.reset_emplace(i, 1.0);
+        });
+    }
+
+    size_t const observer_count = 1 << 21;
+
+    template <typename Weak>
+    void expiry_sweep(char const* name, std::vector<shared_ptr<int>> const& objects)
+    {
+        std::vector<Weak> observers(objects.begin(), objects.end());
+        size_t expired = 0;
+        measure(name, observers.size(), [&] {
+            for (auto const& w : observers)
+                expired += w.expired();
+        });
+        if (expired == 42)
+            std::printf("\n");
+    }
+
+    void bench_compact_weak_sweep()
+    {
+        std::vector<shared_ptr<int>> objects;
+        objects.reserve(observer_count);
+        for (size_t i = 0; i != observer_count; ++i)
+            objects.push_back(make_shared<int>(static_cast<int>(i)));
+        for (size_t i = 0; i < observer_count; i += 2)
+            objects[i].reset();
+
+        expiry_sweep<weak_ptr<int>>("sweep/weak_ptr", objects);
+        expiry_sweep<compact_weak_ptr<int>>("sweep/compact_weak_ptr", objects);
+    }
+
+    // objects are allocated in shuffled order and interleaved with garbage
+    // that is freed again, so neighbouring pointers land far apart in memory
+    std::vector<shared_ptr<int>> scattered_objects(size_t count)
+    {
+        std::vector<shared_ptr<int>> objects;
+        std::vector<shared_ptr<std::vector<char>>> garbage;
+        objects.reserve(count);
+        std::minstd_rand rng(42);
+        for (size_t i = 0; i != count; ++i)
+        {
+            objects.push_back(make_shared<int>(static_cast<int>(i)));
+            if (rng() % 2 == 0)
+                garbage.push_back(make_shared<std::vector<char>>(rng() % 256));
+        }
+        std::shuffle(objects.begin(), objects.end(), rng);
+        return objects;
+    }
+
+    size_t const lock_observers = 1 << 20;
+
+    void bench_lock_all()
+    {
+        std::vector<shared_ptr<int>> objects = scattered_objects(lock_observers);
+        std::vector<weak_ptr<int>> observers(objects.begin(), objects.end());
+        for (size_t i = 0; i < objects.size(); i += 4)
+            objects[i].reset();
+
+        std::vector<shared_ptr<int>> locked;
+        locked.reserve(lock_observers);
+
+        std::vector<weak_ptr<int>> plain = observers;
+        measure("lock_all/loop", lock_observers, [&] {
+            size_t live = 0;
+            for (size_t i = 0; i != plain.size(); ++i)
+            {
+                if (shared_ptr<int> p = plain[i].lock())
+                {
+                    locked.push_back(std::move(p));
+                    plain[live++] = std::move(plain[i]);
+                }
+            }
+            plain.resize(live);
+        });
+        locked.clear();
+
+        measure("lock_all/prefetched", lock_observers, [&] {
+            size_t live = lock_all(std::span(observers), std::back_inserter(locked));
+            observers.resize(live);
+        });
+    }
+
+    size_t const erase_observers = 10000000;
+
+    void erase_expired_sweep(char const* layout, std::vector<shared_ptr<int>> objects)
+    {
+        std::vector<weak_ptr<int>> observers(objects.begin(), objects.end());
+        std::minstd_rand rng(7);
+        for (auto& o : objects)
+        {
+            if (rng() % 8 == 0)
+                o.reset();
+        }
+
+        std::string prefix = std::string("erase_expired/") + layout;
+        std::vector<weak_ptr<int>> work = observers;
+        measure((prefix + "/erase_if").c_str(), erase_observers, [&] {
+            std::erase_if(work, [](weak_ptr<int> const& w) { return w.expired(); });
+        });
+
+        work = observers;
+        measure((prefix + "/erase_expired").c_str(), erase_observers, [&] { erase_expired(work); });
+    }
+
+    void bench_erase_expired()
+    {
+        std::vector<shared_ptr<int>> sequential;
+        sequential.reserve(erase_observers);
+        for (size_t i = 0; i != erase_observers; ++i)
+            sequential.push_back(make_shared<int>(static_cast<int>(i)));
+        erase_expired_sweep("sequential", std::move(sequential));
+        erase_expired_sweep("scattered", scattered_objects(erase_observers));
+    }
+
+    struct particle
+    {
+        double position[4];
+        double velocity[4];
+    };
+
+    size_t const traversal_objects = 1 << 22;
+
+    void bench_prefetched_traversal()
+    {
+        std::vector<shared_ptr<particle>> objects;
+        std::vector<shared_ptr<std::vector<char>>> garbage;
+        objects.reserve(traversal_objects);
+        std::minstd_rand rng(42);
+        for (size_t i = 0; i != traversal_objects; ++i)
+        {
+            double d = static_cast<double>(i);
+            objects.push_back(make_shared<particle>(particle{{d, d, d, d}, {1, 1, 1, 1}}));
+            if (rng() % 2 == 0)
+                garbage.push_back(make_shared<std::vector<char>>(rng() % 256));
+        }
+        std::shuffle(objects.begin(), objects.end(), rng);
+
+        double sum = 0;
+        auto visit = [&sum](shared_ptr<particle> const& p) { sum += p->position[0] + p->velocity[0]; };
+        measure("traverse/plain", traversal_objects, [&] {
+            for (auto const& p : objects)
+                visit(p);
+        });
+        for (size_t distance : {4, 8, 16, 32})
+        {
+            std::string name = "traverse/prefetch_" + std::to_string(distance);
+            measure(name.c_str(), traversal_objects, [&] { for_each_prefetched(objects, visit, distance); });
+        }
+        measure("traverse/prefetch_16_control", traversal_objects, [&] {
+            for_each_prefetched(objects, visit, 16, true);
+        });
+        if (sum == 42)
+            std::printf("\n");
+    }
+
+    struct plugin
+    {
+        template <class Visitor>
+        void for_each_child(Visitor&& visit)
+        {
+            visit(peer);
+        }
+
+        shared_ptr<plugin> peer;
+    };
+
+    size_t const cycle_candidates = 1000000;
+
+    void bench_collect_cycles()
+    {
+        collect_cycles();
+        {
+            std::vector<shared_ptr<plugin>> live;
+            live.reserve(cycle_candidates);
+            for (size_t i = 0; i != cycle_candidates / 2; ++i)
+            {
+                shared_ptr<plugin> a = make_collectable<plugin>();
+                shared_ptr<plugin> b = make_collectable<plugin>();
+                a->peer = b;
+                b->peer = a;
+                live.push_back(a);
+                live.push_back(b);
+            }
+            live.clear();
+            measure("collect_cycles/garbage_pairs", cycle_candidates, [] { collect_cycles(); });
+        }
+
+        std::vector<shared_ptr<plugin>> live;
+        live.reserve(cycle_candidates);
+        for (size_t i = 0; i != cycle_candidates; ++i)
+        {
+            live.push_back(make_collectable<plugin>());
+            if (i != 0)
+                live[i - 1]->peer = live[i];
+        }
+        for (size_t i = 0; i != cycle_candidates; ++i)
+            shared_ptr<plugin>(live[i]).reset();
+        measure("collect_cycles/live_chain", cycle_candidates, [] { collect_cycles(); });
+    }
+
+    struct cached_page
+    {
+        explicit cached_page(uint64_t key)
+        {
+            for (auto& w : words)
+                w = key;
+        }
+
+        uint64_t words[16];
+    };
+
+    size_t const cache_lookups = 1 << 22;
+    size_t const cache_keys = 1 << 16;
+
+    // lookups on log-uniform keys, so popularity falls off with the key, reporting
+    // the time per lookup and the hit rate
+    void cache_run(size_t entries, size_t shards, size_t threads)
+    {
+        using cache_type = lru_cache<uint64_t, cached_page>;
+        cache_type cache(entries * cache_type::entry_charge, shards);
+        std::string name = "cache/" + std::to_string(entries) + "_entries/" + std::to_string(shards) + "_shards/" +
+                           std::to_string(threads) + "_threads";
+        std::atomic<uint64_t> sum(0);
+        measure(name.c_str(), cache_lookups, [&] {
+            std::vector<std::thread> workers;
+            for (size_t t = 0; t != threads; ++t)
+            {
+                workers.emplace_back([&, t] {
+                    std::minstd_rand rng(static_cast<unsigned>(t + 1));
+                    std::uniform_real_distribution<double> draw(0, 1);
+                    uint64_t local = 0;
+                    for (size_t i = 0; i != cache_lookups / threads; ++i)
+                    {
+                        double u = draw(rng);
+                        uint64_t key = static_cast<uint64_t>(std::pow(double(cache_keys), u)) - 1;
+                        local += cache.get_or_create(key, [key] { return cached_page(key); })->words[0];
+                    }
+                    sum += local;
+                });
+            }
+            for (auto& w : workers)
+                w.join();
+        });
+        std::printf("%-48s %10.2f %%\n", (name + "/hit_rate").c_str(),
+                    100.0 * cache.hits() / static_cast<double>(cache.hits() + cache.misses()));
+        if (sum == 42)
+            std::printf("\n");
+    }
+
+    void bench_cache()
+    {
+        for (size_t entries : {size_t(1) << 10, size_t(1) << 14})
+        {
+            for (size_t threads : {1, 4})
+            {
+                cache_run(entries, 1, threads);
+                cache_run(entries, 16, threads);
+            }
+        }
+    }
+
+    size_t const pingpong_rounds = 1 << 15;
+
+    // two threads hand a counter back and forth through pairs of promises,
+    // each round trip crossing two futures
+    template <template <typename> class Promise, template <typename> class Future>
+    void pingpong(char const* name)
+    {
+        std::vector<Promise<size_t>> ping(pingpong_rounds), pong(pingpong_rounds);
+        std::vector<Future<size_t>> ping_f, pong_f;
+        for (size_t i = 0; i != pingpong_rounds; ++i)
+        {
+            ping_f.push_back(ping[i].get_future());
+            pong_f.push_back(pong[i].get_future());
+        }
+        measure(name, pingpong_rounds, [&] {
+            std::thread partner([&] {
+                for (size_t i = 0; i != pingpong_rounds; ++i)
+                    pong[i].set_value(ping_f[i].get() + 1);
+            });
+            size_t value = 0;
+            for (size_t i = 0; i != pingpong_rounds; ++i)
+            {
+                ping[i].set_value(value);
+                value = pong_f[i].get();
+            }
+            partner.join();
+        });
+    }
+
+    size_t const future_chains = 1 << 18;
+
+    void bench_future()
+    {
+        pingpong<promise, future>("future/pingpong");
+        pingpong<std::promise, std::future>("future/pingpong_std");
+
+        measure("future/create_set_get", future_chains, [] {
+            for (size_t i = 0; i != future_chains; ++i)
+            {
+                promise<size_t> p;
+                future<size_t> f = p.get_future();
+                p.set_value(i);
+                f.get();
+            }
+        });
+        measure("future/create_set_get_std", future_chains, [] {
+            for (size_t i = 0; i != future_chains; ++i)
+            {
+                std::promise<size_t> p;
+                std::future<size_t> f = p.get_future();
+                p.set_value(i);
+                f.get();
+            }
+        });
+        measure("future/then", future_chains, [] {
+            for (size_t i = 0; i != future_chains; ++i)
+            {
+                promise<size_t> p;
+                future<size_t> f = p.get_future().then([](future<size_t> r) { return r.get() + 1; });
+                p.set_value(i);
+                f.get();
+            }
+        });
+    }
+
+    struct lookup_table
+    {
+        lookup_table()
+        {
+            for (size_t i = 0; i != 256; ++i)
+                entries[i] = i * i % 251;
+        }
+
+        size_t entries[256];
+    };
+
+    struct once_lazy
+    {
+        std::shared_ptr<lookup_table> get()
+        {
+            std::call_once(once, [this] { value = std::make_shared<lookup_table>(); });
+            return value;
+        }
+
+        std::once_flag once;
+        std::shared_ptr<lookup_table> value;
+    };
+
+    struct mutex_lazy
+    {
+        std::shared_ptr<lookup_table> get()
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (!value)
+                value = std::make_shared<lookup_table>();
+            return value;
+        }
+
+        std::mutex lock;
+        std::shared_ptr<lookup_table> value;
+    };
+
+    size_t const lazy_threads = 32;
+    size_t const lazy_rounds = 1 << 10;
+    size_t const lazy_gets_per_round = 16;
+
+    // every round all threads are released together onto a fresh lazy value
+    // and fetch it several times, so the first access is contended
+    template <typename Lazy, typename Create>
+    void lazy_contention(char const* name, Create create)
+    {
+        std::vector<std::unique_ptr<Lazy>> values;
+        for (size_t r = 0; r != lazy_rounds; ++r)
+            values.push_back(create());
+
+        std::barrier<> round_start(static_cast<std::ptrdiff_t>(lazy_threads));
+        std::atomic<size_t> sum(0);
+        measure(name, lazy_rounds * lazy_threads * lazy_gets_per_round, [&] {
+            std::vector<std::thread> threads;
+            for (size_t t = 0; t != lazy_threads; ++t)
+            {
+                threads.emplace_back([&] {
+                    size_t local = 0;
+                    for (auto& v : values)
+                    {
+                        round_start.arrive_and_wait();
+                        for (size_t i = 0; i != lazy_gets_per_round; ++i)
+                            local += v->get()->entries[i];
+                    }
+                    sum += local;
+                });
+            }
+            for (auto& t : threads)
+                t.join();
+        });
+        if (sum == 42)
+            std::printf("\n");
+    }
+
+    void bench_lazy_shared()
+    {
+        lazy_contention<lazy_shared<lookup_table>>("lazy/lazy_shared", [] {
+            return std::make_unique<lazy_shared<lookup_table>>([] { return lookup_table(); });
+        });
+        lazy_contention<once_lazy>("lazy/call_once", [] { return std::make_unique<once_lazy>(); });
+        lazy_contention<mutex_lazy>("lazy/mutex", [] { return std::make_unique<mutex_lazy>(); });
+    }
+
+    // the usual alternative to event_signal: a mutex around a vector of
+    // weak_ptr subscribers, held for the whole emit
+    struct mutex_bus
+    {
+        void subscribe(std::shared_ptr<size_t> const& subscriber)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            subscribers.push_back(subscriber);
+        }
+
+        size_t emit(size_t value)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            size_t called = 0;
+            for (auto const& s : subscribers)
+            {
+                if (auto object = s.lock())
+                {
+                    *object += value;
+                    ++called;
+                }
+            }
+            return called;
+        }
+
+        std::mutex lock;
+        std::vector<std::weak_ptr<size_t>> subscribers;
+    };
+
+    size_t const signal_subscribers = 16;
+    size_t const signal_emits = 1 << 16;
+
+    template <typename Bus>
+    void signal_emit(char const* name, Bus& bus, size_t threads)
+    {
+        std::atomic<size_t> called(0);
+        measure(name, signal_emits * threads, [&] {
+            std::vector<std::thread> emitters;
+            for (size_t t = 0; t != threads; ++t)
+            {
+                emitters.emplace_back([&] {
+                    size_t local = 0;
+                    for (size_t i = 0; i != signal_emits; ++i)
+                        local += bus.emit(i);
+                    called += local;
+                });
+            }
+            for (auto& t : emitters)
+                t.join();
+        });
+        if (called == 42)
+            std::printf("\n");
+    }
+
+    void bench_signal()
+    {
+        event_signal<void(size_t)> signal;
+        std::vector<shared_ptr<std::atomic<size_t>>> listeners;
+        for (size_t i = 0; i != signal_subscribers; ++i)
+        {
+            listeners.push_back(make_shared<std::atomic<size_t>>(0));
+            signal.subscribe(listeners.back(), [](std::atomic<size_t>& total, size_t value) {
+                total.fetch_add(value, std::memory_order_relaxed);
+            });
+        }
+
+        mutex_bus bus;
+        std::vector<std::shared_ptr<size_t>> bus_listeners;
+        for (size_t i = 0; i != signal_subscribers; ++i)
+        {
+            bus_listeners.push_back(std::make_shared<size_t>(0));
+            bus.subscribe(bus_listeners.back());
+        }
+
+        for (size_t threads : {size_t(1), size_t(4)})
+        {
+            char name[64];
+            std::snprintf(name, sizeof(name), "signal/event_signal/%zu_threads", threads);
+            signal_emit(name, signal, threads);
+            std::snprintf(name, sizeof(name), "signal/mutex_vector/%zu_threads", threads);
+            signal_emit(name, bus, threads);
+        }
+    }
+
+    size_t const snapshot_versions = 1 << 8;
+    size_t const snapshot_updates = 16;
+
+    // each version keeps the previous one as a snapshot and then applies a
+    // few updates, as a writer does under snapshot isolation
+    template <typename Map, typename Assign>
+    void snapshot_versions_run(char const* name, size_t entries, Assign assign)
+    {
+        Map current;
+        for (size_t i = 0; i != entries; ++i)
+            assign(current, i, i);
+
+        std::mt19937_64 rng(1);
+        std::vector<Map> versions;
+        versions.reserve(snapshot_versions);
+        measure(name, snapshot_versions, [&] {
+            for (size_t v = 0; v != snapshot_versions; ++v)
+            {
+                versions.push_back(current);
+                for (size_t u = 0; u != snapshot_updates; ++u)
+                    assign(current, rng() % entries, v);
+            }
+        });
+    }
+
+    template <typename Map, typename Find>
+    void snapshot_lookups(char const* name, Map const& map, size_t entries, Find find)
+    {
+        size_t const lookups = 1 << 20;
+        size_t sum = 0;
+        measure(name, lookups, [&] {
+            for (size_t i = 0; i != lookups; ++i)
+                sum += find(map, (i * 7919) % entries);
+        });
+        if (sum == 42)
+            std::printf("\n");
+    }
+
+    void bench_hamt()
+    {
+        using hamt = hamt_map<size_t, size_t>;
+        using unordered = std::unordered_map<size_t, size_t>;
+        auto hamt_assign = [](hamt& m, size_t key, size_t value) { m.insert_or_assign(key, value); };
+        auto unordered_assign = [](unordered& m, size_t key, size_t value) { m.insert_or_assign(key, value); };
+
+        for (size_t entries : {size_t(1) << 10, size_t(1) << 16})
+        {
+            char name[64];
+            std::snprintf(name, sizeof(name), "hamt/versions/hamt/%zu", entries);
+            snapshot_versions_run<hamt>(name, entries, hamt_assign);
+            std::snprintf(name, sizeof(name), "hamt/versions/unordered_map_copy/%zu", entries);
+            snapshot_versions_run<unordered>(name, entries, unordered_assign);
+
+            hamt h;
+            unordered u;
+            for (size_t i = 0; i != entries; ++i)
+            {
+                h.insert_or_assign(i, i);
+                u.insert_or_assign(i, i);
+            }
+            std::snprintf(name, sizeof(name), "hamt/lookup/hamt/%zu", entries);
+            snapshot_lookups(name, h, entries, [](hamt const& m, size_t key) { return *m.find(key); });
+            std::snprintf(name, sizeof(name), "hamt/lookup/unordered_map/%zu", entries);
+            snapshot_lookups(name, u, entries, [](unordered const& m, size_t key) { return m.find(key)->second; });
+        }
+    }
+
+    size_t const slot_map_objects = 1 << 18;
+    size_t const slot_map_passes = 16;
+
+    template <typename Handle, typename Step>
+    void slot_map_handles(char const* layout, std::vector<Handle> const& handles, Step step)
+    {
+        char name[64];
+        std::snprintf(name, sizeof(name), "slot_map/lookup/%s", layout);
+        double sum = 0;
+        measure(name, slot_map_passes * handles.size(), [&] {
+            for (size_t p = 0; p != slot_map_passes; ++p)
+            {
+                for (auto const& h : handles)
+                    sum += h->position[0];
+            }
+        });
+
+        std::snprintf(name, sizeof(name), "slot_map/iterate/%s", layout);
+        measure(name, slot_map_passes * handles.size(), [&] {
+            for (size_t p = 0; p != slot_map_passes; ++p)
+                step();
+        });
+
+        std::snprintf(name, sizeof(name), "slot_map/copy_release/%s", layout);
+        std::vector<Handle> copies;
+        copies.reserve(handles.size());
+        measure(name, handles.size(), [&] {
+            for (auto const& h : handles)
+                copies.push_back(h);
+            copies.clear();
+        });
+        if (sum == 42)
+            std::printf("\n");
+    }
+
+    // handles are visited in an order unrelated to creation, like entities
+    // referenced from a spatial index
+    void bench_slot_map()
+    {
+        std::minstd_rand rng(42);
+        std::vector<size_t> order(slot_map_objects);
+        for (size_t i = 0; i != order.size(); ++i)
+            order[i] = i;
+        std::shuffle(order.begin(), order.end(), rng);
+
+        {
+            slot_map<particle> map;
+            map.reserve(slot_map_objects);
+            std::vector<shared_handle<particle>> created;
+            for (size_t i = 0; i != slot_map_objects; ++i)
+                created.push_back(map.emplace(particle{{double(i)}, {1.0}}));
+            std::vector<shared_handle<particle>> handles;
+            for (size_t i : order)
+                handles.push_back(created[i]);
+            created.clear();
+
+            slot_map_handles("slot_map", handles, [&map] {
+                for (particle& p : map.values())
+                    p.position[0] += p.velocity[0];
+            });
+        }
+
+        std::vector<shared_ptr<particle>> created;
+        for (size_t i = 0; i != slot_map_objects; ++i)
+            created.push_back(make_shared<particle>(particle{{double(i)}, {1.0}}));
+        std::vector<shared_ptr<particle>> handles;
+        for (size_t i : order)
+            handles.push_back(created[i]);
+        created.clear();
+
+        slot_map_handles("vector_shared_ptr", handles, [&handles] {
+            for (auto const& p : handles)
+                p->position[0] += p->velocity[0];
+        });
+    }
+
+    size_t const table_rows = 1 << 18;
+    size_t const table_columns = 16;
+    size_t const table_derivations = 32;
+
+    // the same data as a table without shared columns, copied whole to
+    // derive a view
+    using copied_table = std::vector<std::vector<double>>;
+
+    void bench_column_table()
+    {
+        char const* names[table_columns] = {"c0", "c1", "c2",  "c3",  "c4",  "c5",  "c6",  "c7",
+                                            "c8", "c9", "c10", "c11", "c12", "c13", "c14", "c15"};
+        table shared;
+        copied_table copied(table_columns);
+        for (size_t c = 0; c != table_columns; ++c)
+        {
+            auto values = make_column<double>(table_rows, [c](size_t i) { return static_cast<double>(i * c); });
+            shared = shared.with_column(names[c], values);
+            copied[c].assign(values->begin(), values->end());
+        }
+
+        std::vector<table> views;
+        views.reserve(table_derivations);
+        measure("column_table/project/shared_columns", table_derivations, [&] {
+            for (size_t i = 0; i != table_derivations; ++i)
+                views.push_back(shared.select({"c1", "c3", "c5", "c7"}));
+        });
+        views.clear();
+
+        measure("column_table/transform/shared_columns", table_derivations, [&] {
+            for (size_t i = 0; i != table_derivations; ++i)
+                views.push_back(shared.transform<double>("c3", [](double v) { return v * 1.5; }));
+        });
+        views.clear();
+
+        std::vector<copied_table> copies;
+        copies.reserve(table_derivations);
+        measure("column_table/transform/copied_table", table_derivations, [&] {
+            for (size_t i = 0; i != table_derivations; ++i)
+            {
+                copies.push_back(copied);
+                for (double& v : copies.back()[3])
+                    v *= 1.5;
+            }
+        });
+        copies.clear();
+
+        auto mask = make_column<bool>(table_rows, [](size_t i) { return i % 2 == 0; });
+        measure("column_table/filter/shared_columns", table_derivations / 4, [&] {
+            for (size_t i = 0; i != table_derivations / 4; ++i)
+                views.push_back(shared.filter(*mask));
+        });
+        views.clear();
+    }
+
+    struct benchmark
+    {
+        char const* name;
+        void (*run)();
+    };
+
+    benchmark const benchmarks[] = {
+        {"fanout", bench_fanout},
+        {"expire", bench_expire_callbacks},
+        {"entity", bench_entity_group},
+        {"message", bench_trailing_message},
+        {"pipeline", bench_buffer_recycling},
+        {"emplace", bench_reset_emplace},
+        {"sweep", bench_compact_weak_sweep},
+        {"lock_all", bench_lock_all},
+        {"erase_expired", bench_erase_expired},
+        {"traverse", bench_prefetched_traversal},
+        {"collect_cycles", bench_collect_cycles},
+        {"cache", bench_cache},
+        {"future", bench_future},
+        {"lazy", bench_lazy_shared},
+        {"signal", bench_signal},
+        {"hamt", bench_hamt},
+        {"slot_map", bench_slot_map},
+        {"column_table", bench_column_table},
+    };
+}
+
+int main(int argc, char** argv)
+{
+    char const* filter = argc > 1 ? argv[1] : "";
+    for (auto const& b : benchmarks)
+    {
+        if (std::strstr(b.name, filter) != nullptr)
+            b.run();
+    }
+    return 0;
+}
@@ -0,0 +1,20 @@
+#!/bin/sh
+# Checks that a binary carries the shared_ptr USDT probes in its
+# .note.stapsdt section; usage: check_probes.sh <binary>
+set -e
+
+binary="$1"
+if [ -z "$binary" ]; then
+    echo "usage: $0 <binary>" >&2
+    exit 2
+fi
+
+notes=$(readelf -n "$binary")
+status=0
+for probe in control_block_create final_release object_deleted control_block_free; do
+    if ! printf '%s\n' "$notes" | grep -A2 'stapsdt' | grep -q "Name: $probe\$"; then
+        echo "missing probe shared_ptr:$probe" >&2
+        status=1
+    fi
+done
+exit $status
@@ -0,0 +1,224 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+#include <shared_ptr.h>
+
+// Column-oriented table whose columns are immutable and shared. A column is
+// one make_shared_with_trailing allocation with its values behind the
+// header, starting on a column_alignment boundary so that loops over them
+// vectorize with aligned loads. Tables hold shared_ptr<const column<T>>, so
+// deriving a table copies only the column handles: a projection shares all
+// the columns it keeps, replacing a column materializes just that one, and
+// only a filter that drops rows has to gather every column.
+//
+// Lookups of a missing column throw std::out_of_range, and a column of the
+// wrong type or length std::invalid_argument.
+
+inline constexpr size_t column_alignment = 64;
+
+template <typename T>
+struct alignas(column_alignment) column {
+  // the trailing elements of the column's own allocation
+  std::span<T> values;
+
+  size_t size() const noexcept {
+    return values.size();
+  }
+
+  T* data() noexcept {
+    return values.data();
+  }
+
+  const T* data() const noexcept {
+    return values.data();
+  }
+
+  const T& operator[](size_t i) const noexcept {
+    return values[i];
+  }
+
+  const T* begin() const noexcept {
+    return values.data();
+  }
+
+  const T* end() const noexcept {
+    return values.data() + values.size();
+  }
+};
+
+// n value-initialized values, to be filled in before the column is shared
+template <class T>
+shared_ptr<column<T>> make_column(size_t n) {
+  auto created = make_shared_with_trailing<column<T>, T>(n);
+  created.header->values = created.trailing;
+  return std::move(created.header);
+}
+
+// the values generate(0), ..., generate(n - 1)
+template <class T, class Generate>
+shared_ptr<const column<T>> make_column(size_t n, Generate&& generate) {
+  shared_ptr<column<T>> result = make_column<T>(n);
+  T* out = result->data();
+  for (size_t i = 0; i != n; ++i) {
+    out[i] = generate(i);
+  }
+  return result;
+}
+
+struct table {
+  // constructors
+  table() = default;
+
+  // observers
+  size_t rows() const noexcept {
+    return row_count;
+  }
+
+  size_t column_count() const noexcept {
+    return entries.size();
+  }
+
+  bool contains(std::string_view name) const noexcept {
+    return find(name) != nullptr;
+  }
+
+  std::vector<std::string_view> names() const {
+    std::vector<std::string_view> result;
+    result.reserve(entries.size());
+    for (const entry& e : entries) {
+      result.push_back(e.name);
+    }
+    return result;
+  }
+
+  template <class T>
+  shared_ptr<const column<T>> get(std::string_view name) const {
+    const entry& e = at(name);
+    if (*e.type != typeid(T)) {
+      throw std::invalid_argument("column " + std::string(name) + " has a different type");
+    }
+    return shared_ptr<const column<T>>(e.data, static_cast<const column<T>*>(e.data.get()));
+  }
+
+  // derived tables
+
+  // this table plus values under name, replacing the column of that name if
+  // there is one; the first column of an empty table sets the row count
+  template <class T>
+  table with_column(std::string name, shared_ptr<const column<T>> values) const {
+    if (!entries.empty() && values->size() != row_count) {
+      throw std::invalid_argument("column " + name + " does not match the row count");
+    }
+    table result = *this;
+    result.row_count = values->size();
+    entry added{std::move(name), &typeid(T), std::move(values), &gather<T>};
+    if (entry* existing = result.find(added.name)) {
+      *existing = std::move(added);
+    } else {
+      result.entries.push_back(std::move(added));
+    }
+    return result;
+  }
+
+  // replaces the column name with f applied to each of its values
+  template <class T, class F>
+  table transform(std::string_view name, F&& f) const {
+    shared_ptr<const column<T>> source = get<T>(name);
+    using result_type = std::decay_t<decltype(f(std::declval<const T&>()))>;
+    const T* in = source->data();
+    shared_ptr<const column<result_type>> values =
+        make_column<result_type>(row_count, [in, &f](size_t i) { return f(in[i]); });
+    return with_column(std::string(name), std::move(values));
+  }
+
+  // the named columns, in the given order
+  table select(std::initializer_list<std::string_view> keep) const {
+    table result;
+    result.row_count = row_count;
+    result.entries.reserve(keep.size());
+    for (std::string_view name : keep) {
+      result.entries.push_back(at(name));
+    }
+    return result;
+  }
+
+  table without(std::string_view name) const {
+    table result = *this;
+    result.entries.erase(result.entries.begin() + (&at(name) - entries.data()));
+    return result;
+  }
+
+  // the rows whose mask value is set; shares every column if that is all
+  // of them
+  table filter(const column<bool>& mask) const {
+    if (mask.size() != row_count) {
+      throw std::invalid_argument("filter mask does not match the row count");
+    }
+    std::vector<uint32_t> kept;
+    kept.reserve(row_count);
+    for (size_t i = 0; i != row_count; ++i) {
+      if (mask[i]) {
+        kept.push_back(static_cast<uint32_t>(i));
+      }
+    }
+    if (kept.size() == row_count) {
+      return *this;
+    }
+    table result;
+    result.row_count = kept.size();
+    result.entries.reserve(entries.size());
+    for (const entry& e : entries) {
+      result.entries.push_back(entry{e.name, e.type, e.gather(e.data.get(), kept), e.gather});
+    }
+    return result;
+  }
+
+ private:
+  struct entry {
+    std::string name;
+    const std::type_info* type;
+    shared_ptr<const void> data;
+    // builds a column from the given rows of data
+    shared_ptr<const void> (*gather)(const void* data, std::span<const uint32_t> rows);
+  };
+
+  template <class T>
+  static shared_ptr<const void> gather(const void* data, std::span<const uint32_t> rows) {
+    const T* in = static_cast<const column<T>*>(data)->data();
+    return make_column<T>(rows.size(), [in, rows](size_t i) { return in[rows[i]]; });
+  }
+
+  const entry* find(std::string_view name) const noexcept {
+    for (const entry& e : entries) {
+      if (e.name == name) {
+        return &e;
+      }
+    }
+    return nullptr;
+  }
+
+  entry* find(std::string_view name) noexcept {
+    return const_cast<entry*>(static_cast<const table*>(this)->find(name));
+  }
+
+  const entry& at(std::string_view name) const {
+    const entry* e = find(name);
+    if (e == nullptr) {
+      throw std::out_of_range("no column " + std::string(name));
+    }
+    return *e;
+  }
+
+  size_t row_count = 0;
+  std::vector<entry> entries;
+};
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <shared_ptr.h>
+
+// weak_ptr that stores only the control block and recovers the object
+// address from it on lock(). It can only observe non-aliased pointers,
+// i.e. ones whose get() is the address the control block was created with;
+// constructed from any other pointer, an aliased one or one converted to a
+// base class at a nonzero offset, it is empty
+template <typename T>
+struct compact_weak_ptr {
+  // constructors
+  constexpr compact_weak_ptr() noexcept : control(nullptr) {}
+
+  compact_weak_ptr(const compact_weak_ptr& r) noexcept : control(r.control) {
+    increase_control();
+  }
+
+  template <class Y>
+  compact_weak_ptr(const shared_ptr<Y>& r) noexcept : control(observable(r)) {
+    increase_control();
+  }
+
+  compact_weak_ptr(compact_weak_ptr&& r) noexcept : compact_weak_ptr() {
+    r.swap(*this);
+  }
+
+  // destructor
+  ~compact_weak_ptr() {
+    if (control != nullptr) {
+      control->release_weak();
+    }
+  }
+
+  // operator=
+  compact_weak_ptr& operator=(const compact_weak_ptr& r) noexcept {
+    compact_weak_ptr(r).swap(*this);
+    return *this;
+  }
+
+  template <class Y>
+  compact_weak_ptr& operator=(const shared_ptr<Y>& r) noexcept {
+    compact_weak_ptr(r).swap(*this);
+    return *this;
+  }
+
+  compact_weak_ptr& operator=(compact_weak_ptr&& r) noexcept {
+    compact_weak_ptr(std::move(r)).swap(*this);
+    return *this;
+  }
+
+  // modifiers
+  void reset() noexcept {
+    compact_weak_ptr().swap(*this);
+  }
+
+  void swap(compact_weak_ptr& r) noexcept {
+    std::swap(control, r.control);
+  }
+
+  // observers
+  size_t use_count() const noexcept {
+    return control == nullptr ? 0 : control->shared_counter.load(std::memory_order_relaxed);
+  }
+
+  bool expired() const noexcept {
+    return use_count() == 0;
+  }
+
+  shared_ptr<T> lock() const noexcept {
+    if (control == nullptr || !control->try_add_shared()) {
+      return shared_ptr<T>();
+    }
+    return shared_ptr<T>::adopt(control, static_cast<T*>(control->get_object()));
+  }
+
+ private:
+  // the control block of r if lock() can recover r.get() from it
+  template <class Y>
+  static control_block* observable(const shared_ptr<Y>& r) noexcept {
+    if (r.control == nullptr || static_cast<const volatile void*>(static_cast<T*>(r.ptr)) != r.control->get_object()) {
+      return nullptr;
+    }
+    return r.control;
+  }
+
+  void increase_control() {
+    if (control != nullptr) {
+      control->add_weak();
+    }
+  }
+
+  control_block* control;
+};
@@ -1,34 +1,376 @@
 #pragma once
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <futex.h>
+#include <no_exceptions.h>
+#include <probes.h>
+#include <trace_recorder.h>
+
+struct expire_callback {
+  expire_callback* next;
+  std::function<void()> fn;
+};
+
 struct control_block {
-  size_t shared_counter = 0;
-  size_t weak_counter = 0;
+  std::atomic<size_t> shared_counter{0};
+  // all strong owners together hold one weak reference, so whichever of the
+  // last strong and the last weak release happens second frees the block
+  std::atomic<size_t> weak_counter{1};
+  // number of threads in weak_ptr::wait_until_expired; the top bit is set
+  // once the object has expired and they have been woken
+  std::atomic<uint32_t> expiry_waiters{0};
+  static constexpr uint32_t expired_bit = uint32_t(1) << 31;
+  // opt-in cycle collection state, see cycle_collector.h
+  std::atomic<uint8_t> collector_flags{0};
+  static constexpr uint8_t collectable_flag = 1;
+  static constexpr uint8_t buffered_flag = 2;
+  // stack of callbacks to run after delete_object(), null for most objects
+  std::atomic<expire_callback*> expire_callbacks{nullptr};
+#if defined(SHARED_PTR_TRACE)
+  uint64_t trace_id = trace_recorder::next_block_id();
+#endif
+
+  control_block() noexcept {
+    SHARED_PTR_PROBE(control_block_create, this);
+    SHARED_PTR_TRACE_OP(this, create);
+  }
 
   virtual void delete_object() = 0;
+  // address of the owned object as it was handed to the first shared_ptr
+  virtual void* get_object() noexcept = 0;
+  // called when shared_counter drops to a nonzero value on a block that
+  // has collectable_flag set
+  virtual void on_possible_cycle_root() noexcept {}
+  // frees the block once the last weak reference is gone; blocks in storage
+  // managed elsewhere override it, see embedded_control_block.h
+  virtual void destroy_block() noexcept {
+    delete this;
+  }
   virtual ~control_block() = default;
+
+  void add_shared(size_t n = 1) noexcept {
+    SHARED_PTR_TRACE_OP(this, add_shared);
+    shared_counter.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  // increments shared_counter unless the object is already dead
+  bool try_add_shared() noexcept {
+    size_t count = shared_counter.load(std::memory_order_relaxed);
+    while (count != 0) {
+      if (shared_counter.compare_exchange_weak(count, count + 1, std::memory_order_relaxed)) {
+        SHARED_PTR_TRACE_OP(this, lock);
+        return true;
+      }
+    }
+    SHARED_PTR_TRACE_OP(this, lock_failed);
+    return false;
+  }
+
+  void release_shared(size_t n = 1) noexcept {
+    SHARED_PTR_TRACE_OP(this, release_shared);
+    // read before the decrement, after it another owner may free the block
+    if (collector_flags.load(std::memory_order_relaxed) & collectable_flag) {
+      release_collectable(n);
+      return;
+    }
+    // seq_cst for notify_expired, see there; on x86 every locked
+    // instruction is a full barrier, so this costs nothing over acq_rel
+    if (shared_counter.fetch_sub(n, std::memory_order_seq_cst) == n) {
+      SHARED_PTR_PROBE(final_release, this);
+      delete_object();
+      finish_expiry();
+    }
+  }
+
+  // drops the last strong reference of an object that was already
+  // destroyed by other means, by the cycle collector or a reset_emplace
+  // whose constructor threw
+  void release_destroyed() noexcept {
+    SHARED_PTR_TRACE_OP(this, release_shared);
+    SHARED_PTR_PROBE(final_release, this);
+    shared_counter.store(0, std::memory_order_seq_cst);
+    finish_expiry();
+  }
+
+  void add_weak() noexcept {
+    SHARED_PTR_TRACE_OP(this, add_weak);
+    weak_counter.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void release_weak() noexcept {
+    SHARED_PTR_TRACE_OP(this, release_weak);
+    drop_weak();
+  }
+
+  // must be called by a strong owner, so the object cannot expire meanwhile
+  void add_expire_callback(std::function<void()> fn) {
+    expire_callback* node = new_block<expire_callback>(expire_callbacks.load(std::memory_order_relaxed), std::move(fn));
+    if (node == nullptr) {
+      report_allocation_failure();
+      return;
+    }
+    while (!expire_callbacks.compare_exchange_weak(node->next, node, std::memory_order_release,
+                                                   std::memory_order_relaxed)) {
+    }
+  }
+
+  // returns true if shared_counter reached zero before timeout
+  bool wait_until_expired(std::chrono::nanoseconds timeout) noexcept {
+    auto deadline = deadline_after(timeout);
+    bool expired = false;
+    expiry_waiters.fetch_add(1);
+    for (;;) {
+      uint32_t waiters = expiry_waiters.load();
+      if (shared_counter.load() == 0) {
+        expired = true;
+        break;
+      }
+      auto now = std::chrono::steady_clock::now();
+      if (now >= deadline) {
+        break;
+      }
+      futex_wait_for(expiry_waiters, waiters, deadline - now);
+    }
+    expiry_waiters.fetch_sub(1);
+    return expired;
+  }
+
+ private:
+  // a release that leaves the object alive makes it a possible cycle root,
+  // which can only be recorded while a weak reference pins the block
+  void release_collectable(size_t n) noexcept {
+    weak_counter.fetch_add(1, std::memory_order_relaxed);
+    if (shared_counter.fetch_sub(n, std::memory_order_seq_cst) == n) {
+      SHARED_PTR_PROBE(final_release, this);
+      delete_object();
+      finish_expiry();
+    } else {
+      on_possible_cycle_root();
+    }
+    drop_weak();
+  }
+
+  void finish_expiry() noexcept {
+    SHARED_PTR_PROBE(object_deleted, this);
+    if (expire_callbacks.load(std::memory_order_acquire) != nullptr) {
+      run_expire_callbacks();
+    }
+    notify_expired();
+    drop_weak();
+  }
+
+  // release_weak without the trace record, for the reference that the
+  // strong owners hold together
+  void drop_weak() noexcept {
+    if (weak_counter.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      SHARED_PTR_PROBE(control_block_free, this);
+      destroy_block();
+    }
+  }
+
+  void run_expire_callbacks() noexcept {
+    expire_callback* node = expire_callbacks.exchange(nullptr, std::memory_order_acquire);
+    expire_callback* ordered = nullptr;
+    while (node != nullptr) {
+      expire_callback* next = node->next;
+      node->next = ordered;
+      ordered = node;
+      node = next;
+    }
+    while (ordered != nullptr) {
+      expire_callback* next = ordered->next;
+      ordered->fn();
+      delete ordered;
+      ordered = next;
+    }
+  }
+
+  void notify_expired() noexcept {
+    // the seq_cst decrement of shared_counter before this load pairs with
+    // the registration in wait_until_expired: either the waiter sees
+    // shared_counter == 0 or we see it registered
+    if (expiry_waiters.load(std::memory_order_seq_cst) != 0) {
+      expiry_waiters.fetch_or(expired_bit);
+      futex_wake_all(expiry_waiters);
+    }
+  }
 };
 
 template <typename T, typename Deleter>
 struct not_init_block : control_block, Deleter {
   T* ptr;
 
-  not_init_block(T* p, Deleter d) : ptr(p), Deleter(std::move(d)) {}
+  not_init_block(T* p, Deleter d) : Deleter(std::move(d)), ptr(p) {}
 
   void delete_object() override {
     static_cast<Deleter&>(*this)(ptr);
   }
+
+  void* get_object() noexcept override {
+    return const_cast<std::remove_cv_t<T>*>(ptr);
+  }
 };
 
 template <typename T>
 struct init_block : control_block{
-  typename std::aligned_storage<sizeof(T), alignof(T)> data;
+  typename std::aligned_storage<sizeof(T), alignof(T)>::type data;
 
   template <typename ...Args>
   explicit init_block(Args&& ...args) {
     new (&data) T(std::forward<Args>(args)...);
   }
 
+  T* get() {
+    return reinterpret_cast<T*>(&data);
+  }
+
+  void delete_object() override {
+    get()->~T();
+  }
+
+  void* get_object() noexcept override {
+    return &data;
+  }
+};
+
+// sub-objects laid out one after another in declaration order, each built
+// from its own tuple of constructor arguments
+template <typename ...Ts>
+struct group_members {
+  group_members() = default;
+};
+
+template <typename T, typename ...Rest>
+struct group_members<T, Rest...> {
+  T head;
+  group_members<Rest...> tail;
+
+  group_members() : head(), tail() {}
+
+  template <typename Tuple, typename ...Tuples>
+  explicit group_members(Tuple&& args, Tuples&& ...rest)
+      : head(std::make_from_tuple<T>(std::forward<Tuple>(args))), tail(std::forward<Tuples>(rest)...) {}
+};
+
+template <size_t I, typename T, typename ...Rest>
+auto& group_get(group_members<T, Rest...>& members) {
+  if constexpr (I == 0) {
+    return members.head;
+  } else {
+    return group_get<I - 1>(members.tail);
+  }
+}
+
+template <typename ...Ts>
+struct group_block : control_block {
+  typename std::aligned_storage<sizeof(group_members<Ts...>), alignof(group_members<Ts...>)>::type data;
+
+  template <typename ...Tuples>
+  explicit group_block(Tuples&& ...args) {
+    new (&data) group_members<Ts...>(std::forward<Tuples>(args)...);
+  }
+
+  group_members<Ts...>& members() {
+    return *reinterpret_cast<group_members<Ts...>*>(&data);
+  }
+
   void delete_object() override {
-    reinterpret_cast<T*>(&data)->~T();
+    members().~group_members();
+  }
+
+  void* get_object() noexcept override {
+    return &data;
+  }
+};
+
+// Header followed by `size` Elems in the same allocation; the elements start
+// at elements_offset() from the beginning of the block
+template <typename Header, typename Elem>
+struct trailing_block : control_block {
+  size_t size;
+  typename std::aligned_storage<sizeof(Header), alignof(Header)>::type header;
+
+  static constexpr size_t alignment() {
+    return alignof(Elem) > alignof(trailing_block) ? alignof(Elem) : alignof(trailing_block);
+  }
+
+  static constexpr size_t elements_offset() {
+    return (sizeof(trailing_block) + alignof(Elem) - 1) / alignof(Elem) * alignof(Elem);
+  }
+
+  // null only if the allocation fails in the exception-free mode, n too
+  // large to fit in size_t bytes counting as a failed allocation
+  template <typename ...Args>
+  static trailing_block* create(size_t n, Args&& ...args) {
+    if (n > (SIZE_MAX - elements_offset()) / sizeof(Elem)) {
+#if SHARED_PTR_EXCEPTIONS
+      throw std::bad_array_new_length();
+#else
+      return nullptr;
+#endif
+    }
+#if SHARED_PTR_EXCEPTIONS
+    void* memory = ::operator new(elements_offset() + n * sizeof(Elem), std::align_val_t(alignment()));
+#else
+    void* memory = ::operator new(elements_offset() + n * sizeof(Elem), std::align_val_t(alignment()), std::nothrow);
+    if (memory == nullptr) {
+      return nullptr;
+    }
+#endif
+    SHARED_PTR_TRY {
+      return ::new (memory) trailing_block(n, std::forward<Args>(args)...);
+    } SHARED_PTR_CATCH_ALL {
+      ::operator delete(memory, std::align_val_t(alignment()));
+      SHARED_PTR_RETHROW;
+    }
+  }
+
+  static void operator delete(void* p) {
+    ::operator delete(p, std::align_val_t(alignment()));
+  }
+
+  Header* get_header() {
+    return reinterpret_cast<Header*>(&header);
+  }
+
+  Elem* elements() {
+    return reinterpret_cast<Elem*>(reinterpret_cast<char*>(this) + elements_offset());
+  }
+
+  void delete_object() override {
+    get_header()->~Header();
+    destroy_elements(size);
+  }
+
+  void* get_object() noexcept override {
+    return &header;
+  }
+
+ private:
+  template <typename ...Args>
+  explicit trailing_block(size_t n, Args&& ...args) : size(0) {
+    SHARED_PTR_TRY {
+      for (; size != n; ++size) {
+        ::new (static_cast<void*>(elements() + size)) Elem();
+      }
+      ::new (&header) Header(std::forward<Args>(args)...);
+    } SHARED_PTR_CATCH_ALL {
+      destroy_elements(size);
+      SHARED_PTR_RETHROW;
+    }
+  }
+
+  void destroy_elements(size_t constructed) {
+    while (constructed != 0) {
+      elements()[--constructed].~Elem();
+    }
   }
 };
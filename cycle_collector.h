@@ -0,0 +1,245 @@
+#pragma once
+
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <shared_ptr.h>
+
+// Opt-in synchronous cycle collector after Bacon and Rajan. A type takes part
+// by being created with make_collectable and by exposing its children:
+//
+//   template <class Visitor>
+//   void for_each_child(Visitor&& visit) { visit(left); visit(right); }
+//
+// where every argument is a shared_ptr member. Whenever the shared_counter of
+// such an object drops to a nonzero value the block is buffered as a possible
+// cycle root; collect_cycles() then trial-deletes the references internal to
+// the subgraphs reachable from the buffered roots and frees whatever only
+// keeps itself alive.
+//
+// Buffering is thread-safe, but collect_cycles() must not run while other
+// threads mutate collectable objects. Destructors of garbage objects may not
+// rely on the other members of their cycle, which can be destroyed first.
+
+struct collectable_block_base : control_block {
+  collectable_block_base() {
+    collector_flags.store(collectable_flag, std::memory_order_relaxed);
+  }
+
+  // calls visit(child, context) for every collectable child block
+  virtual void visit_children(void (*visit)(collectable_block_base*, void*), void* context) = 0;
+
+  void on_possible_cycle_root() noexcept override;
+};
+
+template <typename T>
+struct collectable_block : collectable_block_base {
+  typename std::aligned_storage<sizeof(T), alignof(T)>::type data;
+
+  template <typename ...Args>
+  explicit collectable_block(Args&& ...args) {
+    new (&data) T(std::forward<Args>(args)...);
+  }
+
+  T* get() {
+    return reinterpret_cast<T*>(&data);
+  }
+
+  void delete_object() override {
+    get()->~T();
+  }
+
+  void* get_object() noexcept override {
+    return &data;
+  }
+
+  void visit_children(void (*visit)(collectable_block_base*, void*), void* context) override {
+    get()->for_each_child([&](const auto& child) {
+      control_block* c = ptr_access::control(child);
+      if (c != nullptr && (c->collector_flags.load(std::memory_order_relaxed) & collectable_flag)) {
+        visit(static_cast<collectable_block_base*>(c), context);
+      }
+    });
+  }
+};
+
+struct cycle_root_buffer {
+  std::mutex lock;
+  // every buffered block is pinned by a weak reference
+  std::vector<collectable_block_base*> roots;
+
+  static cycle_root_buffer& instance() {
+    static cycle_root_buffer buffer;
+    return buffer;
+  }
+};
+
+inline void collectable_block_base::on_possible_cycle_root() noexcept {
+  if (collector_flags.fetch_or(buffered_flag, std::memory_order_relaxed) & buffered_flag) {
+    return;
+  }
+  add_weak();
+  cycle_root_buffer& buffer = cycle_root_buffer::instance();
+  std::lock_guard<std::mutex> guard(buffer.lock);
+  buffer.roots.push_back(this);
+}
+
+template <class T, class... Args>
+shared_ptr<T> make_collectable(Args&&... args) {
+  auto* block = new collectable_block<T>(std::forward<Args>(args)...);
+  block->add_shared();
+  return ptr_access::adopt(block, block->get());
+}
+
+struct cycle_collector {
+  // returns the number of objects freed
+  size_t collect() {
+    {
+      cycle_root_buffer& buffer = cycle_root_buffer::instance();
+      std::lock_guard<std::mutex> guard(buffer.lock);
+      roots.swap(buffer.roots);
+    }
+
+    for (collectable_block_base* root : roots) {
+      root->collector_flags.fetch_and(static_cast<uint8_t>(~control_block::buffered_flag), std::memory_order_relaxed);
+      if (root->shared_counter.load(std::memory_order_acquire) != 0) {
+        mark_gray(root);
+      }
+    }
+    for (collectable_block_base* root : roots) {
+      scan(root);
+    }
+    for (collectable_block_base* root : roots) {
+      collect_white(root);
+    }
+
+    // pin the garbage so that destroying one object cannot release another
+    // one through the normal path, and mark it buffered so that it is not
+    // queued as a root again; then destroy everything and let go
+    for (collectable_block_base* block : garbage) {
+      block->add_shared();
+      block->collector_flags.fetch_or(control_block::buffered_flag, std::memory_order_relaxed);
+    }
+    for (collectable_block_base* block : garbage) {
+      block->delete_object();
+    }
+    for (collectable_block_base* block : garbage) {
+      block->release_destroyed();
+    }
+    for (collectable_block_base* block : roots) {
+      block->release_weak();
+    }
+
+    size_t freed = garbage.size();
+    roots.clear();
+    garbage.clear();
+    nodes.clear();
+    return freed;
+  }
+
+ private:
+  enum class color { black, gray, white };
+
+  struct node {
+    size_t count;
+    color c;
+  };
+
+  node& state(collectable_block_base* block) {
+    auto [it, inserted] = nodes.try_emplace(block);
+    if (inserted) {
+      it->second = {block->shared_counter.load(std::memory_order_acquire), color::black};
+    }
+    return it->second;
+  }
+
+  // the recursive steps of the algorithm run on an explicit stack so that
+  // long chains cannot overflow the call stack
+  template <class F>
+  void for_each_child(collectable_block_base* block, F f) {
+    block->visit_children([](collectable_block_base* child, void* context) { (*static_cast<F*>(context))(child); }, &f);
+  }
+
+  void mark_gray(collectable_block_base* root) {
+    node& s = state(root);
+    if (s.c == color::gray) {
+      return;
+    }
+    s.c = color::gray;
+    stack.push_back(root);
+    while (!stack.empty()) {
+      collectable_block_base* block = stack.back();
+      stack.pop_back();
+      for_each_child(block, [this](collectable_block_base* child) {
+        node& t = state(child);
+        t.count--;
+        if (t.c != color::gray) {
+          t.c = color::gray;
+          stack.push_back(child);
+        }
+      });
+    }
+  }
+
+  void scan(collectable_block_base* root) {
+    stack.push_back(root);
+    while (!stack.empty()) {
+      collectable_block_base* block = stack.back();
+      stack.pop_back();
+      node& s = state(block);
+      if (s.c != color::gray) {
+        continue;
+      }
+      if (s.count > 0) {
+        scan_black(block);
+        continue;
+      }
+      s.c = color::white;
+      for_each_child(block, [this](collectable_block_base* child) { stack.push_back(child); });
+    }
+  }
+
+  void scan_black(collectable_block_base* root) {
+    state(root).c = color::black;
+    std::vector<collectable_block_base*> black_stack{root};
+    while (!black_stack.empty()) {
+      collectable_block_base* block = black_stack.back();
+      black_stack.pop_back();
+      for_each_child(block, [this, &black_stack](collectable_block_base* child) {
+        node& t = state(child);
+        t.count++;
+        if (t.c != color::black) {
+          t.c = color::black;
+          black_stack.push_back(child);
+        }
+      });
+    }
+  }
+
+  void collect_white(collectable_block_base* root) {
+    stack.push_back(root);
+    while (!stack.empty()) {
+      collectable_block_base* block = stack.back();
+      stack.pop_back();
+      node& s = state(block);
+      if (s.c != color::white) {
+        continue;
+      }
+      s.c = color::black;
+      garbage.push_back(block);
+      for_each_child(block, [this](collectable_block_base* child) { stack.push_back(child); });
+    }
+  }
+
+  std::vector<collectable_block_base*> roots;
+  std::vector<collectable_block_base*> garbage;
+  std::vector<collectable_block_base*> stack;
+  std::unordered_map<collectable_block_base*, node> nodes;
+};
+
+// runs one collection over the roots buffered so far, returns the number
+// of objects freed
+inline size_t collect_cycles() {
+  cycle_collector collector;
+  return collector.collect();
+}
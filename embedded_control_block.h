@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <utility>
+#include <shared_ptr.h>
+
+// Control block living in storage the caller manages, a member of the object
+// or a slot of a preallocated buffer, so that handing out a shared_ptr
+// allocates nothing. Instead of destroying the object and freeing the block,
+// the last strong owner calls dispose(object) and the last weak reference
+// calls release(object); afterwards the block is back in its initial state
+// and can share an object again.
+//
+// A block that is a member of the object must outlive every weak_ptr to it,
+// so its dispose may only make the object logically dead and the object's
+// lifetime has to end in release.
+
+// callback that does nothing, for objects in static storage
+struct no_op_callback {
+  template <class T>
+  void operator()(T*) const noexcept {}
+};
+
+// callback that ends the object's lifetime, for objects placement-new'ed
+// into a buffer
+struct destroy_in_place {
+  template <class T>
+  void operator()(T* p) const noexcept {
+    p->~T();
+  }
+};
+
+template <typename T, typename Dispose = no_op_callback, typename Release = no_op_callback>
+struct embedded_control_block : control_block {
+  T* object = nullptr;
+  [[no_unique_address]] Dispose dispose;
+  [[no_unique_address]] Release release;
+
+  explicit embedded_control_block(Dispose d = Dispose(), Release r = Release())
+      : dispose(std::move(d)), release(std::move(r)) {}
+
+  embedded_control_block(const embedded_control_block&) = delete;
+  embedded_control_block& operator=(const embedded_control_block&) = delete;
+
+  void delete_object() override {
+    dispose(object);
+  }
+
+  void* get_object() noexcept override {
+    return object;
+  }
+
+  void destroy_block() noexcept override {
+    T* released = std::exchange(object, nullptr);
+    weak_counter.store(1, std::memory_order_relaxed);
+    expiry_waiters.store(0, std::memory_order_relaxed);
+    collector_flags.store(0, std::memory_order_relaxed);
+    release(released);
+  }
+};
+
+template <class T, class Dispose, class Release = no_op_callback>
+embedded_control_block<T, Dispose, Release> make_embedded_block(Dispose dispose, Release release = Release()) {
+  return embedded_control_block<T, Dispose, Release>(std::move(dispose), std::move(release));
+}
+
+// the first shared_ptr to object, which block must not be sharing already
+template <class T, class Dispose, class Release>
+shared_ptr<T> share_embedded(embedded_control_block<T, Dispose, Release>& block, T* object) noexcept {
+  block.object = object;
+  block.add_shared();
+  return ptr_access::adopt(static_cast<control_block*>(&block), object);
+}
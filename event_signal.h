@@ -0,0 +1,147 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <utility>
+#include <atomic_shared_ptr.h>
+#include <shared_ptr.h>
+
+// Signal/slot event whose subscribers are tracked through weak_ptrs. The
+// subscriber list is an immutable array, allocated in one piece with
+// make_shared_with_trailing and published through an atomic_shared_ptr:
+// emit() takes a snapshot with a single load and calls the live subscribers
+// without any lock, while subscribe() and unsubscribe() copy the array and
+// swap the copy in. Subscribers found expired during an emit are pruned the
+// same way.
+
+template <typename Signature>
+struct event_signal;
+
+template <typename... Args>
+struct event_signal<void(Args...)> {
+  using connection = uint64_t;
+
+  // constructors
+  event_signal() = default;
+
+  event_signal(const event_signal&) = delete;
+  event_signal& operator=(const event_signal&) = delete;
+
+  // calls f(*subscriber, args...) on every emit for as long as the object
+  // owned by subscriber is alive
+  template <class T, class F>
+  connection subscribe(const shared_ptr<T>& subscriber, F f) {
+    connection id = next_id.fetch_add(1, std::memory_order_relaxed);
+    slot added{id, weak_ptr<void>(subscriber), [f = std::move(f)](void* object, Args... args) {
+                 f(*static_cast<T*>(object), std::forward<Args>(args)...);
+               }};
+    update([&added](std::span<const slot> current, auto out) {
+      for (const slot& s : current) {
+        out(s);
+      }
+      out(added);
+    });
+    return id;
+  }
+
+  // returns false if the connection was gone already
+  bool unsubscribe(connection id) {
+    bool found = false;
+    update([id, &found](std::span<const slot> current, auto out) {
+      found = false;
+      for (const slot& s : current) {
+        if (s.id == id) {
+          found = true;
+        } else {
+          out(s);
+        }
+      }
+    });
+    return found;
+  }
+
+  // calls every live subscriber, returns how many were called
+  template <class... CallArgs>
+  size_t emit(CallArgs&&... args) {
+    shared_ptr<const slot_list> snapshot = subscribers.load();
+    if (!snapshot) {
+      return 0;
+    }
+    size_t called = 0;
+    bool expired = false;
+    for (const slot& s : snapshot->slots) {
+      if (shared_ptr<void> object = s.tracked.lock()) {
+        s.callback(object.get(), args...);
+        ++called;
+      } else {
+        expired = true;
+      }
+    }
+    if (expired) {
+      prune();
+    }
+    return called;
+  }
+
+  // number of subscribers in the current list, including expired ones not
+  // pruned yet
+  size_t size() const noexcept {
+    shared_ptr<const slot_list> snapshot = subscribers.load();
+    return snapshot ? snapshot->slots.size() : 0;
+  }
+
+ private:
+  struct slot {
+    connection id = 0;
+    weak_ptr<void> tracked;
+    std::function<void(void*, Args...)> callback;
+  };
+
+  struct slot_list {
+    // the trailing elements of the list's own allocation
+    std::span<slot> slots;
+  };
+
+  // drops subscribers whose objects have expired
+  void prune() {
+    update([](std::span<const slot> current, auto out) {
+      for (const slot& s : current) {
+        if (!s.tracked.expired()) {
+          out(s);
+        }
+      }
+    });
+  }
+
+  // rebuilds the list from fill(current, out), which passes the slots of the
+  // new list to out, until it is swapped in over an unchanged list
+  template <class Fill>
+  void update(Fill fill) {
+    shared_ptr<const slot_list> current = subscribers.load();
+    for (;;) {
+      std::span<const slot> old_slots;
+      if (current) {
+        old_slots = current->slots;
+      }
+      size_t count = 0;
+      fill(old_slots, [&count](const slot&) { ++count; });
+
+      shared_ptr<const slot_list> next;
+      if (count != 0) {
+        auto created = make_shared_with_trailing<slot_list, slot>(count);
+        created.header->slots = created.trailing;
+        size_t i = 0;
+        fill(old_slots, [&created, &i](const slot& s) { created.trailing[i++] = s; });
+        next = std::move(created.header);
+      }
+      if (subscribers.compare_exchange_strong(current, std::move(next))) {
+        return;
+      }
+    }
+  }
+
+  atomic_shared_ptr<const slot_list> subscribers;
+  std::atomic<connection> next_id{1};
+};
@@ -0,0 +1,333 @@
+#pragma once
+
+#include <chrono>
+#include <exception>
+#include <future>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <control_block.h>
+
+// future/promise whose shared state is one control block: the reference
+// counts, a futex state word and the result live in a single allocation.
+// Waiters sleep on the state word, and the thread that publishes the result
+// only issues a wake when one of them has registered. then() attaches one
+// continuation, which runs on the thread that publishes the result, or right
+// away if the result is already there.
+//
+// Errors are reported with std::future_error like std::future does.
+
+template <typename T>
+struct future;
+
+template <typename T>
+struct promise;
+
+struct future_continuation {
+  virtual void run() noexcept = 0;
+  virtual ~future_continuation() = default;
+};
+
+template <typename F>
+struct future_continuation_impl : future_continuation {
+  F f;
+
+  explicit future_continuation_impl(F&& f) : f(std::move(f)) {}
+
+  void run() noexcept override {
+    f();
+  }
+};
+
+template <typename T>
+struct future_block : control_block {
+  using value_type = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+
+  // the low bits of state hold the result kind, set once
+  static constexpr uint32_t has_value = 1;
+  static constexpr uint32_t has_error = 2;
+  static constexpr uint32_t ready_mask = has_value | has_error;
+  static constexpr uint32_t waiting_bit = 4;
+  static constexpr uint32_t continuation_bit = 8;
+
+  std::atomic<uint32_t> state{0};
+  std::atomic<bool> retrieved{false};
+  typename std::aligned_storage<sizeof(value_type), alignof(value_type)>::type storage;
+  std::exception_ptr error;
+  future_continuation* continuation = nullptr;
+
+  value_type* value() noexcept {
+    return reinterpret_cast<value_type*>(&storage);
+  }
+
+  void delete_object() override {
+    if ((state.load(std::memory_order_relaxed) & ready_mask) == has_value) {
+      value()->~value_type();
+    }
+    error = nullptr;
+    delete continuation;
+  }
+
+  void* get_object() noexcept override {
+    return &storage;
+  }
+
+  bool is_ready() const noexcept {
+    return (state.load(std::memory_order_acquire) & ready_mask) != 0;
+  }
+
+  template <class... Args>
+  void set_value(Args&&... args) {
+    ::new (static_cast<void*>(&storage)) value_type(std::forward<Args>(args)...);
+    publish(has_value);
+  }
+
+  void set_exception(std::exception_ptr e) noexcept {
+    error = std::move(e);
+    publish(has_error);
+  }
+
+  void wait() noexcept {
+    uint32_t s = state.load(std::memory_order_acquire);
+    while ((s & ready_mask) == 0) {
+      if (register_waiter(s)) {
+        futex_wait(state, s);
+        s = state.load(std::memory_order_acquire);
+      }
+    }
+  }
+
+  // returns false if timeout passes before the result is there
+  bool wait_for(std::chrono::nanoseconds timeout) noexcept {
+    auto deadline = deadline_after(timeout);
+    uint32_t s = state.load(std::memory_order_acquire);
+    while ((s & ready_mask) == 0) {
+      auto now = std::chrono::steady_clock::now();
+      if (now >= deadline) {
+        return false;
+      }
+      if (register_waiter(s)) {
+        futex_wait_for(state, s, deadline - now);
+        s = state.load(std::memory_order_acquire);
+      }
+    }
+    return true;
+  }
+
+  // takes ownership of c; runs it now if the result is already there
+  void attach(future_continuation* c) noexcept {
+    continuation = c;
+    if (state.fetch_or(continuation_bit, std::memory_order_acq_rel) & ready_mask) {
+      run_continuation();
+    }
+  }
+
+ private:
+  // sets waiting_bit in s unless it is set already; false if s changed meanwhile
+  bool register_waiter(uint32_t& s) noexcept {
+    if (s & waiting_bit) {
+      return true;
+    }
+    if (state.compare_exchange_weak(s, s | waiting_bit, std::memory_order_acquire)) {
+      s |= waiting_bit;
+      return true;
+    }
+    return false;
+  }
+
+  void publish(uint32_t result) noexcept {
+    uint32_t old = state.fetch_or(result, std::memory_order_acq_rel);
+    if (old & waiting_bit) {
+      futex_wake_all(state);
+    }
+    if (old & continuation_bit) {
+      run_continuation();
+    }
+  }
+
+  void run_continuation() noexcept {
+    future_continuation* c = std::exchange(continuation, nullptr);
+    c->run();
+    delete c;
+  }
+};
+
+template <typename T>
+struct future {
+  // constructors
+  constexpr future() noexcept : block(nullptr) {}
+
+  future(future&& r) noexcept : block(std::exchange(r.block, nullptr)) {}
+
+  future(const future&) = delete;
+
+  // destructor
+  ~future() {
+    if (block != nullptr) {
+      block->release_shared();
+    }
+  }
+
+  // operator=
+  future& operator=(future&& r) noexcept {
+    future(std::move(r)).swap(*this);
+    return *this;
+  }
+
+  future& operator=(const future&) = delete;
+
+  void swap(future& r) noexcept {
+    std::swap(block, r.block);
+  }
+
+  // observers
+  bool valid() const noexcept {
+    return block != nullptr;
+  }
+
+  bool is_ready() const {
+    return checked()->is_ready();
+  }
+
+  void wait() const {
+    checked()->wait();
+  }
+
+  template <class Rep, class Period>
+  std::future_status wait_for(const std::chrono::duration<Rep, Period>& timeout) const {
+    return checked()->wait_for(timeout) ? std::future_status::ready : std::future_status::timeout;
+  }
+
+  // waits for the result and moves it out, or rethrows the stored exception;
+  // the future is no longer valid afterwards
+  T get() {
+    future_block<T>* b = checked();
+    b->wait();
+    future owner(std::exchange(block, nullptr));
+    if (b->state.load(std::memory_order_relaxed) & future_block<T>::has_error) {
+      std::rethrow_exception(b->error);
+    }
+    if constexpr (!std::is_void_v<T>) {
+      return std::move(*b->value());
+    }
+  }
+
+  // Returns a future for f(std::move(*this)), which runs once this future is
+  // ready; an exception thrown by f ends up in the returned future. This
+  // future is no longer valid afterwards
+  template <class F>
+  future<std::invoke_result_t<F, future>> then(F&& f) {
+    using result_type = std::invoke_result_t<F, future>;
+    future_block<T>* b = checked();
+
+    promise<result_type> p;
+    future<result_type> result = p.get_future();
+    auto run = [p = std::move(p), self = std::move(*this), f = std::forward<F>(f)]() mutable {
+      try {
+        if constexpr (std::is_void_v<result_type>) {
+          f(std::move(self));
+          p.set_value();
+        } else {
+          p.set_value(f(std::move(self)));
+        }
+      } catch (...) {
+        p.set_exception(std::current_exception());
+      }
+    };
+    b->attach(new future_continuation_impl<decltype(run)>(std::move(run)));
+    return result;
+  }
+
+ private:
+  // takes over a reference already accounted for in b->shared_counter
+  explicit future(future_block<T>* b) noexcept : block(b) {}
+
+  future_block<T>* checked() const {
+    if (block == nullptr) {
+      throw std::future_error(std::future_errc::no_state);
+    }
+    return block;
+  }
+
+  template <typename Y>
+  friend struct promise;
+  template <typename Y>
+  friend struct future;
+
+  future_block<T>* block;
+};
+
+template <typename T>
+struct promise {
+  // constructors
+  promise() : block(new future_block<T>()) {
+    block->add_shared();
+  }
+
+  promise(promise&& r) noexcept
+      : block(std::exchange(r.block, nullptr)), satisfied(std::exchange(r.satisfied, false)) {}
+
+  promise(const promise&) = delete;
+
+  // destructor; a promise dropped without a result leaves broken_promise
+  ~promise() {
+    if (block == nullptr) {
+      return;
+    }
+    if (!satisfied) {
+      block->set_exception(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+    }
+    block->release_shared();
+  }
+
+  // operator=
+  promise& operator=(promise&& r) noexcept {
+    promise(std::move(r)).swap(*this);
+    return *this;
+  }
+
+  promise& operator=(const promise&) = delete;
+
+  void swap(promise& r) noexcept {
+    std::swap(block, r.block);
+    std::swap(satisfied, r.satisfied);
+  }
+
+  future<T> get_future() {
+    if (block == nullptr) {
+      throw std::future_error(std::future_errc::no_state);
+    }
+    if (block->retrieved.exchange(true, std::memory_order_relaxed)) {
+      throw std::future_error(std::future_errc::future_already_retrieved);
+    }
+    block->add_shared();
+    return future<T>(block);
+  }
+
+  // modifiers
+  template <class... Args>
+  void set_value(Args&&... args) {
+    check_unsatisfied();
+    block->set_value(std::forward<Args>(args)...);
+    satisfied = true;
+  }
+
+  void set_exception(std::exception_ptr e) {
+    check_unsatisfied();
+    satisfied = true;
+    block->set_exception(std::move(e));
+  }
+
+ private:
+  void check_unsatisfied() const {
+    if (block == nullptr) {
+      throw std::future_error(std::future_errc::no_state);
+    }
+    if (satisfied) {
+      throw std::future_error(std::future_errc::promise_already_satisfied);
+    }
+  }
+
+  future_block<T>* block;
+  bool satisfied = false;
+};
@@ -0,0 +1,290 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <utility>
+#include <variant>
+#include <shared_ptr.h>
+
+// Persistent hash array mapped trie. Each node is one make_shared_with_trailing
+// allocation: a 32-bit bitmap followed by one entry per set bit, found by the
+// popcount of the bits below it, where an entry is either a key-value pair or
+// a child node for the next 5 bits of the hash. Keys whose whole hash
+// collides end up in a collision node below the last level, searched
+// linearly.
+//
+// Copying a map is a snapshot that shares every node. A modification copies
+// the nodes on the path to the changed entry, except for the nodes this map
+// owns alone, which it updates in place; a node is only reallocated then when
+// its number of entries changes. The structure is never modified while
+// another map can see it, so maps sharing nodes can be read and modified from
+// different threads as long as each map is used by one thread at a time.
+template <typename Key, typename Value, typename Hash = std::hash<Key>, typename KeyEqual = std::equal_to<Key>>
+struct hamt_map {
+  using value_type = std::pair<Key, Value>;
+
+  // constructors
+  hamt_map() noexcept = default;
+
+  // observers
+  size_t size() const noexcept {
+    return count;
+  }
+
+  bool empty() const noexcept {
+    return count == 0;
+  }
+
+  // null if key is not in the map
+  const Value* find(const Key& key) const {
+    size_t hash = Hash()(key);
+    const node* n = root.get();
+    for (unsigned shift = 0; n != nullptr; shift += bits_per_level) {
+      if (shift >= hash_bits) {
+        for (const entry& e : n->entries) {
+          const value_type& kv = std::get<value_type>(e);
+          if (KeyEqual()(kv.first, key)) {
+            return &kv.second;
+          }
+        }
+        return nullptr;
+      }
+      uint32_t bit = bit_of(hash, shift);
+      if (!(n->bitmap & bit)) {
+        return nullptr;
+      }
+      const entry& e = n->entries[n->index_of(bit)];
+      if (const value_type* kv = std::get_if<value_type>(&e)) {
+        return KeyEqual()(kv->first, key) ? &kv->second : nullptr;
+      }
+      n = std::get<node_ptr>(e).get();
+    }
+    return nullptr;
+  }
+
+  bool contains(const Key& key) const {
+    return find(key) != nullptr;
+  }
+
+  // calls f(key, value) for every entry, in hash order
+  template <class F>
+  void for_each(F&& f) const {
+    if (root) {
+      visit(*root, 0, f);
+    }
+  }
+
+  // modifiers
+
+  // returns true if key was inserted, false if its value was replaced
+  bool insert_or_assign(const Key& key, Value value) {
+    size_t hash = Hash()(key);
+    bool inserted = assign(root, 0, hash, key, std::move(value));
+    count += inserted;
+    return inserted;
+  }
+
+  // returns false if key was not in the map
+  bool erase(const Key& key) {
+    // checked first so that a missing key does not copy the path to it
+    if (!contains(key)) {
+      return false;
+    }
+    remove(root, 0, Hash()(key), key);
+    --count;
+    return true;
+  }
+
+  void clear() noexcept {
+    root.reset();
+    count = 0;
+  }
+
+ private:
+  struct node;
+  using node_ptr = shared_ptr<node>;
+  // default-constructs to an empty child so that make_shared_with_trailing
+  // can value-initialize the entries before they are filled in
+  using entry = std::variant<node_ptr, value_type>;
+
+  struct node {
+    uint32_t bitmap;
+    // the trailing elements of the node's own allocation
+    std::span<entry> entries;
+
+    explicit node(uint32_t b) noexcept : bitmap(b) {}
+
+    size_t index_of(uint32_t bit) const noexcept {
+      return static_cast<size_t>(std::popcount(bitmap & (bit - 1)));
+    }
+  };
+
+  static constexpr unsigned bits_per_level = 5;
+  static constexpr unsigned hash_bits = sizeof(size_t) * 8;
+
+  static uint32_t bit_of(size_t hash, unsigned shift) noexcept {
+    return uint32_t(1) << ((hash >> shift) & 31);
+  }
+
+  static node_ptr allocate(uint32_t bitmap, size_t size) {
+    auto created = make_shared_with_trailing<node, entry>(size, bitmap);
+    created.header->entries = created.trailing;
+    return std::move(created.header);
+  }
+
+  // whether this map owns n alone; the acquire load pairs with the release
+  // decrement of the owners that let go of it, so their reads of the node
+  // happen before this map moves from or writes to it
+  static bool is_sole_owner(const node_ptr& n) noexcept {
+    return ptr_access::control(n)->shared_counter.load(std::memory_order_acquire) == 1;
+  }
+
+  // copies of the entries, moved out instead if nothing else sees them
+  static entry* transfer(std::span<entry> from, entry* to, bool unique) {
+    return unique ? std::move(from.begin(), from.end(), to) : std::copy(from.begin(), from.end(), to);
+  }
+
+  // n with e added at index, under the given bitmap
+  static node_ptr inserted(node_ptr& n, uint32_t bitmap, size_t index, entry&& e) {
+    bool unique = is_sole_owner(n);
+    std::span<entry> from = n->entries;
+    node_ptr result = allocate(bitmap, from.size() + 1);
+    entry* to = transfer(from.first(index), result->entries.data(), unique);
+    *to = std::move(e);
+    transfer(from.subspan(index), to + 1, unique);
+    return result;
+  }
+
+  // n without the entry at index, or null if that was the last one
+  static node_ptr removed(node_ptr& n, uint32_t bitmap, size_t index) {
+    std::span<entry> from = n->entries;
+    if (from.size() == 1) {
+      return node_ptr();
+    }
+    bool unique = is_sole_owner(n);
+    node_ptr result = allocate(bitmap, from.size() - 1);
+    entry* to = transfer(from.first(index), result->entries.data(), unique);
+    transfer(from.subspan(index + 1), to, unique);
+    return result;
+  }
+
+  // makes n safe to modify in place, copying it unless this map owns it alone
+  static void make_editable(node_ptr& n) {
+    if (!is_sole_owner(n)) {
+      node_ptr copy = allocate(n->bitmap, n->entries.size());
+      transfer(n->entries, copy->entries.data(), false);
+      n = std::move(copy);
+    }
+  }
+
+  // a node holding two entries whose hashes agree below shift
+  static node_ptr pair_node(unsigned shift, size_t hash_a, value_type&& a, size_t hash_b, value_type&& b) {
+    if (shift >= hash_bits) {
+      node_ptr n = allocate(0, 2);
+      n->entries[0] = std::move(a);
+      n->entries[1] = std::move(b);
+      return n;
+    }
+    uint32_t bit_a = bit_of(hash_a, shift);
+    uint32_t bit_b = bit_of(hash_b, shift);
+    if (bit_a == bit_b) {
+      node_ptr n = allocate(bit_a, 1);
+      n->entries[0] = pair_node(shift + bits_per_level, hash_a, std::move(a), hash_b, std::move(b));
+      return n;
+    }
+    node_ptr n = allocate(bit_a | bit_b, 2);
+    n->entries[bit_a < bit_b ? 0 : 1] = std::move(a);
+    n->entries[bit_a < bit_b ? 1 : 0] = std::move(b);
+    return n;
+  }
+
+  static bool assign(node_ptr& n, unsigned shift, size_t hash, const Key& key, Value&& value) {
+    if (!n) {
+      n = allocate(bit_of(hash, shift), 1);
+      n->entries[0] = value_type(key, std::move(value));
+      return true;
+    }
+    if (shift >= hash_bits) {
+      for (size_t i = 0; i != n->entries.size(); ++i) {
+        if (KeyEqual()(std::get<value_type>(n->entries[i]).first, key)) {
+          make_editable(n);
+          std::get<value_type>(n->entries[i]).second = std::move(value);
+          return false;
+        }
+      }
+      n = inserted(n, 0, n->entries.size(), value_type(key, std::move(value)));
+      return true;
+    }
+
+    uint32_t bit = bit_of(hash, shift);
+    size_t index = n->index_of(bit);
+    if (!(n->bitmap & bit)) {
+      n = inserted(n, n->bitmap | bit, index, value_type(key, std::move(value)));
+      return true;
+    }
+    make_editable(n);
+    entry& e = n->entries[index];
+    if (node_ptr* child = std::get_if<node_ptr>(&e)) {
+      return assign(*child, shift + bits_per_level, hash, key, std::move(value));
+    }
+    value_type& kv = std::get<value_type>(e);
+    if (KeyEqual()(kv.first, key)) {
+      kv.second = std::move(value);
+      return false;
+    }
+    size_t existing_hash = Hash()(kv.first);
+    e = pair_node(shift + bits_per_level, existing_hash, std::move(kv), hash, value_type(key, std::move(value)));
+    return true;
+  }
+
+  // key must be in the trie below n
+  static void remove(node_ptr& n, unsigned shift, size_t hash, const Key& key) {
+    if (shift >= hash_bits) {
+      size_t i = 0;
+      while (!KeyEqual()(std::get<value_type>(n->entries[i]).first, key)) {
+        ++i;
+      }
+      n = removed(n, 0, i);
+      return;
+    }
+
+    uint32_t bit = bit_of(hash, shift);
+    size_t index = n->index_of(bit);
+    if (std::holds_alternative<value_type>(n->entries[index])) {
+      n = removed(n, n->bitmap & ~bit, index);
+      return;
+    }
+    make_editable(n);
+    entry& e = n->entries[index];
+    node_ptr& child = std::get<node_ptr>(e);
+    remove(child, shift + bits_per_level, hash, key);
+    if (!child) {
+      n = removed(n, n->bitmap & ~bit, index);
+    } else if (child->entries.size() == 1 && std::holds_alternative<value_type>(child->entries[0])) {
+      // a lone pair moves up, keeping the trie as shallow as it was before
+      // the insertions that pushed it down
+      value_type kv = is_sole_owner(child) ? std::move(std::get<value_type>(child->entries[0]))
+                                           : std::get<value_type>(child->entries[0]);
+      e = std::move(kv);
+    }
+  }
+
+  template <class F>
+  static void visit(const node& n, unsigned shift, F& f) {
+    for (const entry& e : n.entries) {
+      if (const value_type* kv = std::get_if<value_type>(&e)) {
+        f(kv->first, kv->second);
+      } else {
+        visit(*std::get<node_ptr>(e), shift + bits_per_level, f);
+      }
+    }
+  }
+
+  node_ptr root;
+  size_t count = 0;
+};
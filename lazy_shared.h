@@ -0,0 +1,119 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <shared_ptr.h>
+
+// A shared value that is built on first use. The control block and the
+// storage for T are allocated up front; the first get() runs the factory
+// into that storage and every later one only checks the state word and
+// takes a reference. Threads that arrive while another one constructs sleep
+// on the state word, and if the factory throws the state goes back to
+// uninitialized so that the next get() tries again.
+//
+// The lazy_shared keeps one reference to the value, so it lives at least as
+// long as the lazy_shared; handles from get() may keep it alive longer.
+
+template <typename T>
+struct lazy_block : control_block {
+  static constexpr uint32_t uninitialized = 0;
+  static constexpr uint32_t constructing = 1;
+  static constexpr uint32_t ready = 2;
+  static constexpr uint32_t waiting_bit = 4;
+
+  std::atomic<uint32_t> state{uninitialized};
+  typename std::aligned_storage<sizeof(T), alignof(T)>::type data;
+  std::function<T()> factory;
+
+  explicit lazy_block(std::function<T()> f) : factory(std::move(f)) {}
+
+  T* get() {
+    return reinterpret_cast<T*>(&data);
+  }
+
+  void delete_object() override {
+    get()->~T();
+  }
+
+  void* get_object() noexcept override {
+    return &data;
+  }
+
+  // returns once the value is built, by this thread or another one
+  void construct() {
+    uint32_t s = state.load(std::memory_order_acquire);
+    while (s != ready) {
+      if ((s & ~waiting_bit) == uninitialized) {
+        if (state.compare_exchange_weak(s, constructing | (s & waiting_bit), std::memory_order_acquire)) {
+          build();
+          return;
+        }
+        continue;
+      }
+      if (!(s & waiting_bit) &&
+          !state.compare_exchange_weak(s, s | waiting_bit, std::memory_order_acquire)) {
+        continue;
+      }
+      futex_wait(state, s | waiting_bit);
+      s = state.load(std::memory_order_acquire);
+    }
+  }
+
+ private:
+  void build() {
+    try {
+      ::new (static_cast<void*>(&data)) T(factory());
+    } catch (...) {
+      if (state.exchange(uninitialized, std::memory_order_release) & waiting_bit) {
+        futex_wake_all(state);
+      }
+      throw;
+    }
+    factory = nullptr;
+    // the reference held by the lazy_shared
+    add_shared();
+    if (state.exchange(ready, std::memory_order_release) & waiting_bit) {
+      futex_wake_all(state);
+    }
+  }
+};
+
+template <typename T>
+struct lazy_shared {
+  // constructors
+  template <class Factory>
+  explicit lazy_shared(Factory&& factory) : block(new lazy_block<T>(std::forward<Factory>(factory))) {}
+
+  lazy_shared(const lazy_shared&) = delete;
+  lazy_shared& operator=(const lazy_shared&) = delete;
+
+  // destructor
+  ~lazy_shared() {
+    if (block->state.load(std::memory_order_acquire) == lazy_block<T>::ready) {
+      block->release_shared();
+    } else {
+      // the weak reference of the strong owners, of which there never were any
+      block->release_weak();
+    }
+  }
+
+  // observers
+
+  // builds the value on the first call; rethrows what the factory throws
+  shared_ptr<T> get() const {
+    if (block->state.load(std::memory_order_acquire) != lazy_block<T>::ready) {
+      block->construct();
+    }
+    block->add_shared();
+    return ptr_access::adopt(block, block->get());
+  }
+
+  bool is_initialized() const noexcept {
+    return block->state.load(std::memory_order_acquire) == lazy_block<T>::ready;
+  }
+
+ private:
+  lazy_block<T>* block;
+};
@@ -0,0 +1,250 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <shared_ptr.h>
+
+// Sharded cache of make_shared values with CLOCK eviction, an approximation
+// of LRU that lets hits run under a shared lock: a hit only copies the
+// shared_ptr and sets the entry's referenced bit, and the hand of the clock
+// clears those bits and evicts the first entry it finds unset. A value handed
+// out by get() stays valid after eviction, which only drops the cache's own
+// reference.
+//
+// Values the cache lets go of are destroyed only after the shard's lock is
+// released, so a destructor that is slow or touches the cache does not run
+// under it.
+//
+// Each entry is charged the size of its fused allocation,
+// sizeof(init_block<Value>), against a capacity in bytes split evenly
+// across the shards; memory the value owns itself is not counted.
+template <typename Key, typename Value, typename Hash = std::hash<Key>, typename KeyEqual = std::equal_to<Key>>
+struct lru_cache {
+  static constexpr size_t entry_charge = sizeof(init_block<Value>);
+
+  // constructors
+  explicit lru_cache(size_t capacity_bytes, size_t shard_count = 16)
+      : shard_capacity(std::max(capacity_bytes / std::max<size_t>(shard_count, 1), entry_charge)),
+        shards(std::max<size_t>(shard_count, 1)) {}
+
+  lru_cache(const lru_cache&) = delete;
+  lru_cache& operator=(const lru_cache&) = delete;
+
+  // lookup
+  shared_ptr<Value> get(const Key& key) const {
+    shard& s = shard_for(key);
+    std::shared_lock<std::shared_mutex> guard(s.lock);
+    auto it = s.index.find(key);
+    if (it == s.index.end()) {
+      s.misses.fetch_add(1, std::memory_order_relaxed);
+      return shared_ptr<Value>();
+    }
+    s.hits.fetch_add(1, std::memory_order_relaxed);
+    const slot& e = s.slots[it->second];
+    if (!e.referenced.load(std::memory_order_relaxed)) {
+      e.referenced.store(true, std::memory_order_relaxed);
+    }
+    return e.value;
+  }
+
+  // modifiers
+
+  // constructs a value for key, replacing any cached one
+  template <class... Args>
+  shared_ptr<Value> emplace(const Key& key, Args&&... args) {
+    shared_ptr<Value> value = ::make_shared<Value>(std::forward<Args>(args)...);
+    shard& s = shard_for(key);
+    dropped_values dropped;
+    std::unique_lock<std::shared_mutex> guard(s.lock);
+    s.store(key, value, shard_capacity, dropped);
+    return value;
+  }
+
+  // returns the cached value for key, or caches and returns make_shared<Value>(create())
+  // on a miss; create runs without any lock held, so racing misses may both run it
+  template <class Create>
+  shared_ptr<Value> get_or_create(const Key& key, Create&& create) {
+    if (shared_ptr<Value> cached = get(key)) {
+      return cached;
+    }
+    shared_ptr<Value> value = ::make_shared<Value>(create());
+    shard& s = shard_for(key);
+    dropped_values dropped;
+    std::unique_lock<std::shared_mutex> guard(s.lock);
+    auto it = s.index.find(key);
+    if (it != s.index.end()) {
+      return s.slots[it->second].value;
+    }
+    s.store(key, value, shard_capacity, dropped);
+    return value;
+  }
+
+  bool erase(const Key& key) {
+    shard& s = shard_for(key);
+    dropped_values dropped;
+    std::unique_lock<std::shared_mutex> guard(s.lock);
+    auto it = s.index.find(key);
+    if (it == s.index.end()) {
+      return false;
+    }
+    s.release(it->second, dropped);
+    s.index.erase(it);
+    return true;
+  }
+
+  void clear() {
+    for (shard& s : shards) {
+      std::vector<slot> dropped;
+      std::unique_lock<std::shared_mutex> guard(s.lock);
+      s.index.clear();
+      dropped.swap(s.slots);
+      s.free_slots.clear();
+      s.hand = 0;
+      s.charge = 0;
+    }
+  }
+
+  // observers
+  size_t size() const {
+    return sum([](const shard& s) { return s.index.size(); });
+  }
+
+  // bytes charged for the cached entries
+  size_t charge() const {
+    return sum([](const shard& s) { return s.charge; });
+  }
+
+  size_t capacity() const noexcept {
+    return shard_capacity * shards.size();
+  }
+
+  size_t hits() const noexcept {
+    return count(&shard::hits);
+  }
+
+  size_t misses() const noexcept {
+    return count(&shard::misses);
+  }
+
+ private:
+  // declared before the lock guard, so that the values are destroyed after
+  // it unlocks
+  using dropped_values = std::vector<shared_ptr<Value>>;
+
+  struct slot {
+    Key key;
+    shared_ptr<Value> value;
+    mutable std::atomic<bool> referenced{false};
+
+    slot(const Key& k, shared_ptr<Value> v) : key(k), value(std::move(v)) {}
+
+    slot(slot&& r) noexcept
+        : key(std::move(r.key)), value(std::move(r.value)), referenced(r.referenced.load(std::memory_order_relaxed)) {}
+
+    slot& operator=(slot&& r) noexcept {
+      key = std::move(r.key);
+      value = std::move(r.value);
+      referenced.store(r.referenced.load(std::memory_order_relaxed), std::memory_order_relaxed);
+      return *this;
+    }
+  };
+
+  // padded so that the locks of neighbouring shards do not share a line
+  struct alignas(64) shard {
+    mutable std::shared_mutex lock;
+    std::unordered_map<Key, size_t, Hash, KeyEqual> index;
+    // the clock; released slots keep an empty value until reused
+    std::vector<slot> slots;
+    std::vector<size_t> free_slots;
+    size_t hand = 0;
+    size_t charge = 0;
+    mutable std::atomic<size_t> hits{0};
+    mutable std::atomic<size_t> misses{0};
+
+    void store(const Key& key, shared_ptr<Value> value, size_t capacity, dropped_values& dropped) {
+      auto it = index.find(key);
+      if (it != index.end()) {
+        slot& e = slots[it->second];
+        dropped.push_back(std::exchange(e.value, std::move(value)));
+        e.referenced.store(false, std::memory_order_relaxed);
+        return;
+      }
+      while (charge + entry_charge > capacity && !index.empty()) {
+        evict_one(dropped);
+      }
+      size_t i;
+      if (free_slots.empty()) {
+        i = slots.size();
+        slots.emplace_back(key, std::move(value));
+      } else {
+        i = free_slots.back();
+        free_slots.pop_back();
+        slots[i] = slot(key, std::move(value));
+      }
+      index.emplace(key, i);
+      charge += entry_charge;
+    }
+
+    void evict_one(dropped_values& dropped) {
+      for (;;) {
+        if (hand == slots.size()) {
+          hand = 0;
+        }
+        slot& e = slots[hand];
+        size_t i = hand++;
+        if (!e.value) {
+          continue;
+        }
+        if (e.referenced.load(std::memory_order_relaxed)) {
+          e.referenced.store(false, std::memory_order_relaxed);
+          continue;
+        }
+        index.erase(e.key);
+        release(i, dropped);
+        return;
+      }
+    }
+
+    void release(size_t i, dropped_values& dropped) {
+      dropped.push_back(std::move(slots[i].value));
+      slots[i].referenced.store(false, std::memory_order_relaxed);
+      free_slots.push_back(i);
+      charge -= entry_charge;
+    }
+  };
+
+  shard& shard_for(const Key& key) const {
+    // the low bits of std::hash are often the key itself, spread them first
+    size_t h = Hash()(key) * 0x9E3779B97F4A7C15ull;
+    return shards[(h >> 32) % shards.size()];
+  }
+
+  template <class F>
+  size_t sum(F f) const {
+    size_t total = 0;
+    for (const shard& s : shards) {
+      std::shared_lock<std::shared_mutex> guard(s.lock);
+      total += f(s);
+    }
+    return total;
+  }
+
+  size_t count(std::atomic<size_t> shard::*counter) const noexcept {
+    size_t total = 0;
+    for (const shard& s : shards) {
+      total += (s.*counter).load(std::memory_order_relaxed);
+    }
+    return total;
+  }
+
+  size_t shard_capacity;
+  mutable std::vector<shard> shards;
+};
@@ -0,0 +1,497 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "shared_ptr.h"
+
+// Workloads shaped like production use of shared ownership, each run on one
+// and on several threads with this library and with std::shared_ptr.
+
+namespace
+{
+    template <typename F>
+    void measure(std::string const& name, size_t operations, F&& f)
+    {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        std::printf("%-48s %10.2f ns/op\n", name.c_str(), elapsed.count() / operations);
+    }
+
+    struct library_pointers
+    {
+        static constexpr char const* name = "shared_ptr";
+
+        template <typename T>
+        using shared = ::shared_ptr<T>;
+        template <typename T>
+        using weak = ::weak_ptr<T>;
+
+        template <typename T, typename... Args>
+        static shared<T> make(Args&&... args)
+        {
+            return ::make_shared<T>(std::forward<Args>(args)...);
+        }
+    };
+
+    struct std_pointers
+    {
+        static constexpr char const* name = "std::shared_ptr";
+
+        template <typename T>
+        using shared = std::shared_ptr<T>;
+        template <typename T>
+        using weak = std::weak_ptr<T>;
+
+        template <typename T, typename... Args>
+        static shared<T> make(Args&&... args)
+        {
+            return std::make_shared<T>(std::forward<Args>(args)...);
+        }
+    };
+
+    size_t const macro_threads = 4;
+
+    // runs body(thread_index) on `threads` threads and waits for all of them
+    template <typename F>
+    void run_threads(size_t threads, F const& body)
+    {
+        if (threads == 1)
+        {
+            body(0);
+            return;
+        }
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t != threads; ++t)
+            workers.emplace_back([&body, t] { body(t); });
+        for (auto& w : workers)
+            w.join();
+    }
+
+    template <typename Pointers>
+    std::string run_name(char const* workload, size_t threads)
+    {
+        return std::string(workload) + "/" + Pointers::name + "/" + std::to_string(threads) + "t";
+    }
+
+    // lru: a mutex-protected cache whose get() hands out shared values that
+    // stay valid after eviction; keys follow a skewed distribution
+
+    struct cached_value
+    {
+        explicit cached_value(uint64_t key)
+        {
+            for (auto& w : payload)
+                w = key;
+        }
+
+        uint64_t payload[16];
+    };
+
+    template <typename Pointers>
+    struct lru_cache
+    {
+        using value_ptr = typename Pointers::template shared<cached_value>;
+
+        explicit lru_cache(size_t capacity)
+            : capacity(capacity)
+        {}
+
+        value_ptr get(uint64_t key)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            auto it = index.find(key);
+            if (it != index.end())
+            {
+                order.splice(order.begin(), order, it->second);
+                return it->second->second;
+            }
+            if (index.size() == capacity)
+            {
+                index.erase(order.back().first);
+                order.pop_back();
+            }
+            order.emplace_front(key, Pointers::template make<cached_value>(key));
+            index.emplace(key, order.begin());
+            return order.front().second;
+        }
+
+        size_t capacity;
+        std::mutex lock;
+        std::list<std::pair<uint64_t, value_ptr>> order;
+        std::unordered_map<uint64_t, typename std::list<std::pair<uint64_t, value_ptr>>::iterator> index;
+    };
+
+    size_t const lru_capacity = 1 << 12;
+    size_t const lru_lookups = 1 << 21;
+
+    template <typename Pointers>
+    void lru_workload(size_t threads)
+    {
+        lru_cache<Pointers> cache(lru_capacity);
+        std::atomic<uint64_t> sum(0);
+        measure(run_name<Pointers>("lru", threads), lru_lookups, [&] {
+            run_threads(threads, [&](size_t t) {
+                std::minstd_rand rng(static_cast<unsigned>(t + 1));
+                // the square of a uniform draw favours small keys
+                std::uniform_real_distribution<double> draw(0, 1);
+                uint64_t local = 0;
+                std::vector<typename Pointers::template shared<cached_value>> held;
+                for (size_t i = 0; i != lru_lookups / threads; ++i)
+                {
+                    double u = draw(rng);
+                    auto value = cache.get(static_cast<uint64_t>(u * u * 4 * lru_capacity));
+                    local += value->payload[0];
+                    // callers keep some values around past their eviction
+                    if (i % 8 == 0)
+                    {
+                        if (held.size() == 64)
+                            held[i / 8 % 64] = std::move(value);
+                        else
+                            held.push_back(std::move(value));
+                    }
+                }
+                sum += local;
+            });
+        });
+        if (sum == 42)
+            std::printf("\n");
+    }
+
+    // ast: build random expression trees, fold constants into new trees that
+    // share the unchanged subtrees, then drop everything
+
+    template <typename Pointers>
+    struct ast_node
+    {
+        using ptr = typename Pointers::template shared<ast_node const>;
+
+        char op;  // '+', '*', 'c' for constants, 'x' for the variable
+        int64_t value;
+        ptr left;
+        ptr right;
+    };
+
+    template <typename Pointers>
+    typename ast_node<Pointers>::ptr build_ast(std::minstd_rand& rng, int depth)
+    {
+        using node = ast_node<Pointers>;
+        if (depth == 0 || rng() % 8 == 0)
+        {
+            if (rng() % 4 == 0)
+                return Pointers::template make<node const>(node{'x', 0, {}, {}});
+            return Pointers::template make<node const>(node{'c', static_cast<int64_t>(rng() % 10), {}, {}});
+        }
+        auto left = build_ast<Pointers>(rng, depth - 1);
+        auto right = build_ast<Pointers>(rng, depth - 1);
+        return Pointers::template make<node const>(node{rng() % 2 ? '+' : '*', 0, std::move(left), std::move(right)});
+    }
+
+    template <typename Pointers>
+    typename ast_node<Pointers>::ptr fold_constants(typename ast_node<Pointers>::ptr const& n)
+    {
+        using node = ast_node<Pointers>;
+        if (n->op == 'c' || n->op == 'x')
+            return n;
+        auto left = fold_constants<Pointers>(n->left);
+        auto right = fold_constants<Pointers>(n->right);
+        if (left->op == 'c' && right->op == 'c')
+        {
+            int64_t v = n->op == '+' ? left->value + right->value : left->value * right->value;
+            return Pointers::template make<node const>(node{'c', v, {}, {}});
+        }
+        if (left == n->left && right == n->right)
+            return n;
+        return Pointers::template make<node const>(node{n->op, 0, std::move(left), std::move(right)});
+    }
+
+    size_t const ast_trees = 1 << 11;
+    int const ast_depth = 10;
+
+    template <typename Pointers>
+    void ast_workload(size_t threads)
+    {
+        std::atomic<int64_t> sum(0);
+        measure(run_name<Pointers>("ast", threads), ast_trees, [&] {
+            run_threads(threads, [&](size_t t) {
+                std::minstd_rand rng(static_cast<unsigned>(t + 1));
+                int64_t local = 0;
+                for (size_t i = 0; i != ast_trees / threads; ++i)
+                {
+                    auto tree = build_ast<Pointers>(rng, ast_depth);
+                    auto folded = fold_constants<Pointers>(tree);
+                    local += folded->value;
+                }
+                sum += local;
+            });
+        });
+        if (sum == 42)
+            std::printf("\n");
+    }
+
+    // pubsub: publishers emit to weak subscribers, pruning the expired ones,
+    // while subscribers come and go
+
+    struct subscriber
+    {
+        std::atomic<uint64_t> received{0};
+
+        void on_message(uint64_t m)
+        {
+            received.fetch_add(m, std::memory_order_relaxed);
+        }
+    };
+
+    template <typename Pointers>
+    struct topic
+    {
+        using weak_subscriber = typename Pointers::template weak<subscriber>;
+
+        void subscribe(typename Pointers::template shared<subscriber> const& s)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            subscribers.emplace_back(s);
+        }
+
+        void publish(uint64_t m)
+        {
+            std::vector<weak_subscriber> snapshot;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                snapshot = subscribers;
+            }
+            bool expired = false;
+            for (auto const& w : snapshot)
+            {
+                if (auto s = w.lock())
+                    s->on_message(m);
+                else
+                    expired = true;
+            }
+            if (expired)
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                std::erase_if(subscribers, [](weak_subscriber const& w) { return w.expired(); });
+            }
+        }
+
+        std::mutex lock;
+        std::vector<weak_subscriber> subscribers;
+    };
+
+    size_t const pubsub_messages = 1 << 16;
+    size_t const pubsub_subscribers = 64;
+
+    template <typename Pointers>
+    void pubsub_workload(size_t threads)
+    {
+        topic<Pointers> t;
+        measure(run_name<Pointers>("pubsub", threads), pubsub_messages * pubsub_subscribers, [&] {
+            run_threads(threads, [&](size_t index) {
+                std::deque<typename Pointers::template shared<subscriber>> own;
+                for (size_t i = 0; i != pubsub_subscribers / threads; ++i)
+                {
+                    own.push_back(Pointers::template make<subscriber>());
+                    t.subscribe(own.back());
+                }
+                for (size_t i = 0; i != pubsub_messages / threads; ++i)
+                {
+                    t.publish(i);
+                    // replace one subscriber every few messages
+                    if (i % 16 == index % 16)
+                    {
+                        own.pop_front();
+                        own.push_back(Pointers::template make<subscriber>());
+                        t.subscribe(own.back());
+                    }
+                }
+            });
+        });
+    }
+
+    // taskgraph: a layered DAG of shared tasks; finishing a task hands its
+    // dependents a reference each, and the last finished dependency schedules
+
+    template <typename Pointers>
+    struct task
+    {
+        using ptr = typename Pointers::template shared<task>;
+
+        std::atomic<size_t> pending{0};
+        std::vector<ptr> dependents;
+        std::atomic<uint64_t> result{0};
+    };
+
+    template <typename Pointers>
+    struct task_queue
+    {
+        using task_ptr = typename task<Pointers>::ptr;
+
+        void push(task_ptr t)
+        {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                ready.push_back(std::move(t));
+            }
+            wake.notify_one();
+        }
+
+        // returns an empty handle once every task has run
+        task_ptr pop()
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wake.wait(guard, [this] { return !ready.empty() || remaining == 0; });
+            if (ready.empty())
+                return task_ptr();
+            task_ptr t = std::move(ready.front());
+            ready.pop_front();
+            return t;
+        }
+
+        void finished()
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (--remaining == 0)
+                wake.notify_all();
+        }
+
+        std::mutex lock;
+        std::condition_variable wake;
+        std::deque<task_ptr> ready;
+        size_t remaining = 0;
+    };
+
+    size_t const taskgraph_layers = 64;
+    size_t const taskgraph_width = 1024;
+    size_t const taskgraph_fanout = 4;
+
+    template <typename Pointers>
+    void taskgraph_workload(size_t threads)
+    {
+        using task_ptr = typename task<Pointers>::ptr;
+        task_queue<Pointers> queue;
+        std::vector<task_ptr> roots;
+        {
+            std::minstd_rand rng(42);
+            std::vector<task_ptr> all;
+            for (size_t layer = 0; layer != taskgraph_layers; ++layer)
+            {
+                size_t previous = all.size() - (layer == 0 ? 0 : taskgraph_width);
+                size_t current = all.size();
+                for (size_t i = 0; i != taskgraph_width; ++i)
+                    all.push_back(Pointers::template make<task<Pointers>>());
+                for (size_t p = previous; p != current; ++p)
+                {
+                    for (size_t k = 0; k != taskgraph_fanout; ++k)
+                    {
+                        auto const& d = all[current + rng() % taskgraph_width];
+                        all[p]->dependents.push_back(d);
+                        d->pending.fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+            }
+            for (auto const& t : all)
+            {
+                if (t->pending.load(std::memory_order_relaxed) == 0)
+                    roots.push_back(t);
+            }
+        }
+        queue.remaining = taskgraph_layers * taskgraph_width;
+
+        std::atomic<uint64_t> sum(0);
+        measure(run_name<Pointers>("taskgraph", threads), taskgraph_layers * taskgraph_width, [&] {
+            for (auto& r : roots)
+                queue.push(std::move(r));
+            run_threads(threads, [&](size_t) {
+                uint64_t local = 0;
+                while (task_ptr t = queue.pop())
+                {
+                    uint64_t result = t->result.load(std::memory_order_relaxed) + 1;
+                    local += result;
+                    for (auto& d : t->dependents)
+                    {
+                        d->result.fetch_add(result, std::memory_order_relaxed);
+                        if (d->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                            queue.push(d);
+                    }
+                    // the graph is consumed as it runs
+                    t->dependents.clear();
+                    queue.finished();
+                }
+                sum += local;
+            });
+        });
+        if (sum == 42)
+            std::printf("\n");
+    }
+
+    template <template <typename> class Workload>
+    void run_workload()
+    {
+        for (size_t threads : {size_t(1), macro_threads})
+        {
+            Workload<library_pointers>::run(threads);
+            Workload<std_pointers>::run(threads);
+        }
+    }
+
+    template <typename Pointers>
+    struct lru
+    {
+        static void run(size_t threads) { lru_workload<Pointers>(threads); }
+    };
+
+    template <typename Pointers>
+    struct ast
+    {
+        static void run(size_t threads) { ast_workload<Pointers>(threads); }
+    };
+
+    template <typename Pointers>
+    struct pubsub
+    {
+        static void run(size_t threads) { pubsub_workload<Pointers>(threads); }
+    };
+
+    template <typename Pointers>
+    struct taskgraph
+    {
+        static void run(size_t threads) { taskgraph_workload<Pointers>(threads); }
+    };
+
+    struct benchmark
+    {
+        char const* name;
+        void (*run)();
+    };
+
+    benchmark const benchmarks[] = {
+        {"lru", run_workload<lru>},
+        {"ast", run_workload<ast>},
+        {"pubsub", run_workload<pubsub>},
+        {"taskgraph", run_workload<taskgraph>},
+    };
+}
+
+int main(int argc, char** argv)
+{
+    char const* filter = argc > 1 ? argv[1] : "";
+    for (auto const& b : benchmarks)
+    {
+        if (std::strstr(b.name, filter) != nullptr)
+            b.run();
+    }
+    return 0;
+}
@@ -1,6 +1,84 @@
 #include <gtest/gtest.h>
 #include "shared_ptr.h"
 #include "test_object.h"
+#include "weighted_ptr.h"
+#include "compact_weak_ptr.h"
+#include "atomic_weak_ptr.h"
+#include "pointer_algorithms.h"
+#include "cycle_collector.h"
+#include "trace_recorder.h"
+#include "lru_cache.h"
+#include "future.h"
+#include "lazy_shared.h"
+#include "atomic_shared_ptr.h"
+#include "event_signal.h"
+#include "hamt.h"
+#include "slot_map.h"
+#include "column_table.h"
+#include "embedded_control_block.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <filesystem>
+#include <iterator>
+#include <list>
+#include <map>
+#include <new>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <unistd.h>
+
+namespace
+{
+    std::atomic<size_t> allocations(0);
+    std::atomic<size_t> deallocations(0);
+
+    size_t live_allocations()
+    {
+        return allocations.load() - deallocations.load();
+    }
+}
+
+void* operator new(std::size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size == 0 ? 1 : size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, std::nothrow_t const&) noexcept
+{
+    void* p = std::malloc(size == 0 ? 1 : size);
+    if (p != nullptr)
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    if (p != nullptr)
+        deallocations.fetch_add(1, std::memory_order_relaxed);
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    operator delete(p);
+}
+
+void operator delete(void* p, std::nothrow_t const&) noexcept
+{
+    operator delete(p);
+}
 
 template <typename T>
 struct custom_deleter
@@ -22,6 +100,14 @@ private:
 struct base
 {};
 
+struct throwing_object
+{
+    throwing_object()
+    {
+        throw std::runtime_error("construction failed");
+    }
+};
+
 struct derived : base
 {
     explicit derived(bool* deleted)
@@ -566,6 +652,1948 @@ TEST(shared_ptr_testing, conversions_inheritance)
     EXPECT_EQ(d.get(), b.get());
 }
 
+TEST(weighted_ptr_testing, copy_does_not_touch_control_block)
+{
+    test_object::no_new_instances_guard g;
+    shared_ptr<test_object> p(new test_object(42));
+    weighted_ptr<test_object> w(p);
+    size_t count = p.use_count();
+    EXPECT_EQ(1 + weighted_ptr<test_object>::refill_weight, count);
+
+    static_assert(!std::is_constructible_v<weighted_ptr<test_object>, const weighted_ptr<test_object>&>,
+                  "copying splits the source's weight");
+    weighted_ptr<test_object> q = w;
+    EXPECT_EQ(count, p.use_count());
+    EXPECT_EQ(weighted_ptr<test_object>::refill_weight, w.get_weight() + q.get_weight());
+    EXPECT_TRUE(q == w);
+    EXPECT_EQ(42, *q);
+}
+
+TEST(weighted_ptr_testing, weight_exhaustion)
+{
+    test_object::no_new_instances_guard g;
+    bool deleted = false;
+    {
+        weighted_ptr<test_object> w(shared_ptr<test_object>(new test_object(42), custom_deleter<test_object>(&deleted)));
+        EXPECT_EQ(1u, w.get_weight());
+
+        std::vector<weighted_ptr<test_object>> copies;
+        for (size_t i = 0; i != 40; ++i)
+        {
+            copies.emplace_back(w);
+            EXPECT_NE(0u, w.get_weight());
+            EXPECT_NE(0u, copies.back().get_weight());
+        }
+
+        shared_ptr<test_object> s = w.share();
+        size_t total = w.get_weight() + 1;
+        for (auto const& c : copies)
+            total += c.get_weight();
+        EXPECT_EQ(total, s.use_count());
+        s.reset();
+
+        copies.clear();
+        EXPECT_FALSE(deleted);
+        EXPECT_EQ(42, *w);
+    }
+    EXPECT_TRUE(deleted);
+}
+
+TEST(weighted_ptr_testing, share)
+{
+    test_object::no_new_instances_guard g;
+    shared_ptr<test_object> s;
+    {
+        weighted_ptr<test_object> w(make_shared<test_object>(42));
+        s = w.share();
+        EXPECT_EQ(1u, s.use_count() - w.get_weight());
+    }
+    EXPECT_EQ(1u, s.use_count());
+    EXPECT_EQ(42, *s);
+}
+
+TEST(weighted_ptr_testing, cross_thread_release)
+{
+    test_object::no_new_instances_guard g;
+    bool deleted = false;
+    {
+        weighted_ptr<test_object> w(shared_ptr<test_object>(new test_object(42), custom_deleter<test_object>(&deleted)));
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i != 4; ++i)
+        {
+            threads.emplace_back([c = w]() mutable {
+                for (size_t j = 0; j != 1000; ++j)
+                {
+                    weighted_ptr<test_object> d = c;
+                    EXPECT_EQ(42, *d);
+                }
+            });
+        }
+        for (auto& t : threads)
+            t.join();
+        EXPECT_FALSE(deleted);
+    }
+    EXPECT_TRUE(deleted);
+}
+
+TEST(shared_ptr_testing, weak_ptr_wait_until_expired_nullptr)
+{
+    weak_ptr<test_object> q;
+    EXPECT_TRUE(q.wait_until_expired(std::chrono::seconds(0)));
+}
+
+TEST(shared_ptr_testing, weak_ptr_wait_until_expired_timeout)
+{
+    test_object::no_new_instances_guard g;
+    shared_ptr<test_object> p(new test_object(42));
+    weak_ptr<test_object> q = p;
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_FALSE(q.wait_until_expired(std::chrono::milliseconds(20)));
+    EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(20));
+    p.reset();
+    EXPECT_TRUE(q.wait_until_expired(std::chrono::milliseconds(20)));
+}
+
+TEST(shared_ptr_testing, weak_ptr_wait_until_expired_forever)
+{
+    test_object::no_new_instances_guard g;
+    shared_ptr<test_object> p(new test_object(42));
+    weak_ptr<test_object> q = p;
+    std::thread releaser([r = std::move(p)]() mutable {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        r.reset();
+    });
+    EXPECT_TRUE(q.wait_until_expired(std::chrono::nanoseconds::max()));
+    EXPECT_TRUE(q.expired());
+    releaser.join();
+}
+
+TEST(shared_ptr_testing, weak_ptr_wait_until_expired_shutdown)
+{
+    test_object::no_new_instances_guard g;
+    shared_ptr<test_object> p(new test_object(42));
+    weak_ptr<test_object> q = p;
+
+    using clock = std::chrono::steady_clock;
+    std::vector<clock::time_point> released(4);
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i != released.size(); ++i)
+    {
+        workers.emplace_back([r = p, i, &released]() mutable {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10 * i));
+            r.reset();
+            released[i] = clock::now();
+        });
+    }
+    p.reset();
+
+    EXPECT_TRUE(q.wait_until_expired(std::chrono::seconds(10)));
+    clock::time_point woken = clock::now();
+    EXPECT_TRUE(q.expired());
+    g.expect_no_instances();
+    for (auto& t : workers)
+        t.join();
+
+    clock::time_point last_release = *std::max_element(released.begin(), released.end());
+    EXPECT_LT(woken - last_release, std::chrono::milliseconds(100));
+}
+
+TEST(shared_ptr_testing, on_expire)
+{
+    test_object::no_new_instances_guard g;
+    std::vector<int> calls;
+    shared_ptr<test_object> p(new test_object(42));
+    weak_ptr<test_object> q = p;
+    on_expire(p, [&] {
+        g.expect_no_instances();
+        EXPECT_TRUE(q.expired());
+        calls.push_back(1);
+    });
+    on_expire(p, [&] { calls.push_back(2); });
+
+    shared_ptr<test_object> r = p;
+    p.reset();
+    EXPECT_TRUE(calls.empty());
+    r.reset();
+    EXPECT_EQ((std::vector<int>{1, 2}), calls);
+}
+
+TEST(shared_ptr_testing, on_expire_nullptr)
+{
+    bool called = false;
+    on_expire(shared_ptr<test_object>(), [&] { called = true; });
+    EXPECT_FALSE(called);
+}
+
+TEST(shared_ptr_testing, on_expire_cache_eviction)
+{
+    test_object::no_new_instances_guard g;
+    std::map<int, weak_ptr<test_object>> cache;
+    {
+        shared_ptr<test_object> p = make_shared<test_object>(42);
+        cache[42] = p;
+        on_expire(p, [&cache] { cache.erase(42); });
+        EXPECT_EQ(1u, cache.size());
+    }
+    EXPECT_TRUE(cache.empty());
+}
+
+TEST(shared_ptr_testing, make_shared_group)
+{
+    test_object::no_new_instances_guard g;
+    auto [a, b, c] = make_shared_group<test_object, int, test_object>(
+        std::forward_as_tuple(42), std::forward_as_tuple(7), std::forward_as_tuple(43));
+    EXPECT_EQ(42, *a);
+    EXPECT_EQ(7, *b);
+    EXPECT_EQ(43, *c);
+    EXPECT_EQ(3, a.use_count());
+    EXPECT_EQ(3, c.use_count());
+    EXPECT_LT(static_cast<void*>(a.get()), static_cast<void*>(b.get()));
+    EXPECT_LT(static_cast<void*>(b.get()), static_cast<void*>(c.get()));
+}
+
+TEST(shared_ptr_testing, make_shared_group_lifetime)
+{
+    test_object::no_new_instances_guard g;
+    weak_ptr<test_object> w;
+    shared_ptr<int> last;
+    {
+        auto [a, b] = make_shared_group<test_object, int>(std::forward_as_tuple(42), std::forward_as_tuple(7));
+        w = a;
+        last = b;
+    }
+    EXPECT_FALSE(w.expired());
+    EXPECT_EQ(42, *w.lock());
+    last.reset();
+    EXPECT_TRUE(w.expired());
+    g.expect_no_instances();
+}
+
+TEST(shared_ptr_testing, make_shared_group_value_initialized)
+{
+    auto [a, b] = make_shared_group<int, double>();
+    EXPECT_EQ(0, *a);
+    EXPECT_EQ(0.0, *b);
+}
+
+TEST(shared_ptr_testing, make_shared_group_throwing_member)
+{
+    test_object::no_new_instances_guard g;
+    EXPECT_THROW((make_shared_group<test_object, throwing_object>(std::forward_as_tuple(42), std::tuple<>())),
+                 std::runtime_error);
+    g.expect_no_instances();
+}
+
+struct message_header
+{
+    explicit message_header(int id)
+        : id(id)
+    {}
+
+    int id;
+};
+
+struct alignas(32) wide_element
+{
+    char data[32];
+};
+
+TEST(shared_ptr_testing, make_shared_with_trailing)
+{
+    test_object::no_new_instances_guard g;
+    auto [header, body] = make_shared_with_trailing<message_header, double>(0, 5);
+    EXPECT_EQ(5, header->id);
+    EXPECT_TRUE(body.empty());
+
+    auto [h, elems] = make_shared_with_trailing<test_object, int>(4, 42);
+    EXPECT_EQ(42, *h);
+    EXPECT_EQ(4u, elems.size());
+    EXPECT_EQ(1, h.use_count());
+    for (int x : elems)
+        EXPECT_EQ(0, x);
+    EXPECT_LT(static_cast<void*>(h.get()), static_cast<void*>(elems.data()));
+}
+
+TEST(shared_ptr_testing, make_shared_with_trailing_alignment)
+{
+    auto [header, body] = make_shared_with_trailing<message_header, wide_element>(3, 1);
+    EXPECT_EQ(0u, reinterpret_cast<std::uintptr_t>(body.data()) % alignof(wide_element));
+    body[2].data[31] = 'x';
+    EXPECT_EQ('x', body[2].data[31]);
+}
+
+TEST(shared_ptr_testing, make_shared_with_trailing_destruction)
+{
+    test_object::no_new_instances_guard g;
+    weak_ptr<message_header> w;
+    {
+        auto message = make_shared_with_trailing<message_header, std::vector<test_object>>(3, 7);
+        for (auto& v : message.trailing)
+            v.emplace_back(42);
+        w = message.header;
+    }
+    EXPECT_TRUE(w.expired());
+    g.expect_no_instances();
+}
+
+TEST(shared_ptr_testing, make_shared_with_trailing_throwing_header)
+{
+    test_object::no_new_instances_guard g;
+    EXPECT_THROW((make_shared_with_trailing<throwing_object, std::vector<test_object>>(3)), std::runtime_error);
+    g.expect_no_instances();
+}
+
+TEST(shared_ptr_testing, make_shared_with_trailing_overflow)
+{
+    size_t before = allocations.load();
+    EXPECT_THROW((make_shared_with_trailing<message_header, double>(SIZE_MAX / sizeof(double), 1)), std::bad_array_new_length);
+    EXPECT_EQ(before, allocations.load());
+}
+
+TEST(shared_ptr_testing, try_take_unique)
+{
+    test_object::no_new_instances_guard g;
+    shared_ptr<test_object> p = make_shared<test_object>(42);
+    test_object* raw = p.get();
+    unique_shared_ptr<test_object> u = try_take_unique(std::move(p));
+    EXPECT_FALSE(static_cast<bool>(p));
+    EXPECT_EQ(raw, u.get());
+    EXPECT_EQ(42, *u);
+
+    shared_ptr<test_object> q = std::move(u);
+    EXPECT_FALSE(static_cast<bool>(u));
+    EXPECT_EQ(raw, q.get());
+    EXPECT_EQ(1, q.use_count());
+}
+
+TEST(shared_ptr_testing, try_take_unique_shared)
+{
+    test_object::no_new_instances_guard g;
+    shared_ptr<test_object> p(new test_object(42));
+    shared_ptr<test_object> q = p;
+    EXPECT_FALSE(static_cast<bool>(try_take_unique(std::move(p))));
+    EXPECT_TRUE(p == q);
+    EXPECT_EQ(2, p.use_count());
+}
+
+TEST(shared_ptr_testing, try_take_unique_weak_observer)
+{
+    test_object::no_new_instances_guard g;
+    shared_ptr<test_object> p(new test_object(42));
+    weak_ptr<test_object> w = p;
+    EXPECT_FALSE(static_cast<bool>(try_take_unique(std::move(p))));
+    EXPECT_EQ(42, *p);
+    w.reset();
+    EXPECT_TRUE(static_cast<bool>(try_take_unique(std::move(p))));
+}
+
+TEST(shared_ptr_testing, try_take_unique_deleter)
+{
+    test_object::no_new_instances_guard g;
+    bool deleted = false;
+    {
+        shared_ptr<test_object> p(new test_object(42), custom_deleter<test_object>(&deleted));
+        unique_shared_ptr<test_object> u = try_take_unique(std::move(p));
+        EXPECT_FALSE(deleted);
+    }
+    EXPECT_TRUE(deleted);
+}
+
+TEST(shared_ptr_testing, try_take_unique_moved_from_and_reset)
+{
+    test_object::no_new_instances_guard g;
+    {
+        unique_shared_ptr<test_object> u = try_take_unique(make_shared<test_object>(42));
+        unique_shared_ptr<test_object> u2 = std::move(u);
+        shared_ptr<test_object> from_moved(std::move(u));
+        EXPECT_FALSE(static_cast<bool>(from_moved));
+        EXPECT_EQ(0, from_moved.use_count());
+
+        u2.reset();
+        shared_ptr<test_object> from_reset(std::move(u2));
+        EXPECT_FALSE(static_cast<bool>(from_reset));
+        EXPECT_EQ(0, from_reset.use_count());
+    }
+    g.expect_no_instances();
+}
+
+TEST(shared_ptr_testing, try_take_unique_nullptr)
+{
+    shared_ptr<test_object> p;
+    EXPECT_FALSE(static_cast<bool>(try_take_unique(std::move(p))));
+}
+
+TEST(shared_ptr_testing, try_take_unique_aliased_nullptr)
+{
+    test_object::no_new_instances_guard g;
+    {
+        shared_ptr<test_object> owner = make_shared<test_object>(42);
+        shared_ptr<test_object> p(std::move(owner), nullptr);
+        EXPECT_FALSE(static_cast<bool>(try_take_unique(std::move(p))));
+        EXPECT_EQ(1, p.use_count());
+    }
+    g.expect_no_instances();
+}
+
+TEST(shared_ptr_testing, try_make_shared)
+{
+    test_object::no_new_instances_guard g;
+    shared_ptr<test_object> p = try_make_shared<test_object>(42);
+    ASSERT_NE(nullptr, p);
+    EXPECT_EQ(42, *p);
+    p.reset();
+
+    size_t before = live_allocations();
+    EXPECT_THROW(try_make_shared<throwing_object>(), std::runtime_error);
+    EXPECT_EQ(before, live_allocations());
+}
+
+TEST(shared_ptr_testing, reset_emplace)
+{
+    shared_ptr<std::pair<int, double>> p = make_shared<std::pair<int, double>>(42, 1.0);
+    std::pair<int, double>* storage = p.get();
+    size_t before = allocations.load();
+    for (int i = 0; i != 100; ++i)
+    {
+        p.reset_emplace(i, 2.0);
+        EXPECT_EQ(i, p->first);
+    }
+    EXPECT_EQ(before, allocations.load());
+    EXPECT_EQ(storage, p.get());
+    EXPECT_EQ(1, p.use_count());
+}
+
+TEST(shared_ptr_testing, reset_emplace_destroys_previous)
+{
+    test_object::no_new_instances_guard g;
+    shared_ptr<test_object> p = make_shared<test_object>(42);
+    test_object* storage = p.get();
+    p.reset_emplace(43);
+    EXPECT_EQ(43, *p);
+    EXPECT_EQ(storage, p.get());
+}
+
+TEST(shared_ptr_testing, reset_emplace_shared)
+{
+    test_object::no_new_instances_guard g;
+    shared_ptr<test_object> p = make_shared<test_object>(42);
+    shared_ptr<test_object> q = p;
+    test_object* storage = p.get();
+    p.reset_emplace(43);
+    EXPECT_NE(storage, p.get());
+    EXPECT_EQ(43, *p);
+    EXPECT_EQ(42, *q);
+    EXPECT_EQ(1, p.use_count());
+}
+
+TEST(shared_ptr_testing, reset_emplace_weak_observer)
+{
+    test_object::no_new_instances_guard g;
+    shared_ptr<test_object> p = make_shared<test_object>(42);
+    weak_ptr<test_object> w = p;
+    test_object* storage = p.get();
+    p.reset_emplace(43);
+    EXPECT_NE(storage, p.get());
+    EXPECT_TRUE(w.expired());
+    EXPECT_EQ(43, *p);
+}
+
+TEST(shared_ptr_testing, reset_emplace_not_init_block)
+{
+    test_object::no_new_instances_guard g;
+    shared_ptr<test_object> p(new test_object(42));
+    test_object* storage = p.get();
+    p.reset_emplace(43);
+    EXPECT_NE(storage, p.get());
+    EXPECT_EQ(43, *p);
+
+    shared_ptr<test_object> empty;
+    empty.reset_emplace(44);
+    EXPECT_EQ(44, *empty);
+}
+
+struct throwing_on_negative
+{
+    explicit throwing_on_negative(int x)
+    {
+        if (x < 0)
+            throw std::runtime_error("negative");
+    }
+};
+
+TEST(shared_ptr_testing, reset_emplace_throwing)
+{
+    size_t before = live_allocations();
+    shared_ptr<throwing_on_negative> p = make_shared<throwing_on_negative>(1);
+    EXPECT_THROW(p.reset_emplace(-1), std::runtime_error);
+    EXPECT_FALSE(static_cast<bool>(p));
+    EXPECT_EQ(0, p.use_count());
+    EXPECT_EQ(before, live_allocations());
+}
+
+TEST(compact_weak_ptr_testing, size)
+{
+    EXPECT_EQ(sizeof(void*), sizeof(compact_weak_ptr<test_object>));
+    EXPECT_EQ(2 * sizeof(compact_weak_ptr<test_object>), sizeof(weak_ptr<test_object>));
+}
+
+TEST(compact_weak_ptr_testing, lock)
+{
+    test_object::no_new_instances_guard g;
+    shared_ptr<test_object> p(new test_object(42));
+    compact_weak_ptr<test_object> q = p;
+    shared_ptr<test_object> r = q.lock();
+    EXPECT_TRUE(r == p);
+    EXPECT_EQ(42, *r);
+    EXPECT_EQ(2, q.use_count());
+}
+
+TEST(compact_weak_ptr_testing, lock_make_shared)
+{
+    test_object::no_new_instances_guard g;
+    shared_ptr<test_object> p = make_shared<test_object>(42);
+    compact_weak_ptr<test_object> q = p;
+    compact_weak_ptr<test_object> r = q;
+    EXPECT_TRUE(r.lock() == p);
+    p.reset();
+    g.expect_no_instances();
+    EXPECT_TRUE(q.expired());
+    EXPECT_FALSE(static_cast<bool>(r.lock()));
+}
+
+TEST(compact_weak_ptr_testing, lock_nullptr)
+{
+    compact_weak_ptr<test_object> q;
+    EXPECT_TRUE(q.expired());
+    EXPECT_FALSE(static_cast<bool>(q.lock()));
+}
+
+TEST(compact_weak_ptr_testing, conversions)
+{
+    shared_ptr<derived> d;
+    bool deleted = false;
+    d.reset(new derived(&deleted));
+    compact_weak_ptr<base> b = d;
+    EXPECT_EQ(static_cast<base*>(d.get()), b.lock().get());
+
+    shared_ptr<test_object> p = make_shared<test_object>(42);
+    compact_weak_ptr<test_object const> c = p;
+    EXPECT_EQ(42, *c.lock());
+}
+
+struct first_part
+{
+    int first = 1;
+};
+
+struct second_part
+{
+    int second = 2;
+};
+
+struct two_parts : first_part, second_part
+{};
+
+TEST(compact_weak_ptr_testing, unobservable_pointers_give_empty)
+{
+    shared_ptr<two_parts> p = make_shared<two_parts>();
+    compact_weak_ptr<second_part> offset = p;
+    EXPECT_TRUE(offset.expired());
+    EXPECT_FALSE(static_cast<bool>(offset.lock()));
+
+    shared_ptr<int> aliased(p, &p->second);
+    compact_weak_ptr<int> a = aliased;
+    EXPECT_TRUE(a.expired());
+    a = shared_ptr<int>(p, &p->first);
+    EXPECT_EQ(&p->first, a.lock().get());
+}
+
+TEST(compact_weak_ptr_testing, assignment_and_reset)
+{
+    test_object::no_new_instances_guard g;
+    shared_ptr<test_object> p1 = make_shared<test_object>(42);
+    shared_ptr<test_object> p2 = make_shared<test_object>(43);
+    compact_weak_ptr<test_object> q1 = p1;
+    compact_weak_ptr<test_object> q2 = p2;
+    q1 = q2;
+    EXPECT_TRUE(q1.lock() == p2);
+    q2 = std::move(q1);
+    EXPECT_TRUE(q1.expired());
+    q2.reset();
+    EXPECT_TRUE(q2.expired());
+    q1 = p1;
+    EXPECT_EQ(42, *q1.lock());
+}
+
+TEST(atomic_weak_ptr_testing, load_store)
+{
+    test_object::no_new_instances_guard g;
+    shared_ptr<test_object> p = make_shared<test_object>(42);
+    atomic_weak_ptr<test_object> a;
+    EXPECT_TRUE(a.load().expired());
+    a.store(p);
+    EXPECT_TRUE(a.load().lock() == p);
+    EXPECT_EQ(42, *weak_ptr<test_object>(a).lock());
+    a = weak_ptr<test_object>();
+    EXPECT_FALSE(static_cast<bool>(a.load().lock()));
+}
+
+TEST(atomic_weak_ptr_testing, exchange)
+{
+    test_object::no_new_instances_guard g;
+    shared_ptr<test_object> p1(new test_object(42));
+    shared_ptr<test_object> p2(new test_object(43));
+    atomic_weak_ptr<test_object> a(p1);
+    weak_ptr<test_object> old = a.exchange(p2);
+    EXPECT_TRUE(old.lock() == p1);
+    EXPECT_TRUE(a.load().lock() == p2);
+    p2.reset();
+    EXPECT_TRUE(a.load().expired());
+}
+
+TEST(atomic_weak_ptr_testing, compare_exchange)
+{
+    test_object::no_new_instances_guard g;
+    shared_ptr<test_object> p1 = make_shared<test_object>(42);
+    shared_ptr<test_object> p2 = make_shared<test_object>(43);
+    atomic_weak_ptr<test_object> a(p1);
+
+    weak_ptr<test_object> expected = p2;
+    EXPECT_FALSE(a.compare_exchange_strong(expected, p2));
+    EXPECT_TRUE(expected.lock() == p1);
+    EXPECT_TRUE(a.compare_exchange_strong(expected, p2));
+    EXPECT_TRUE(a.load().lock() == p2);
+
+    weak_ptr<test_object> empty;
+    EXPECT_FALSE(a.compare_exchange_weak(empty, p1));
+    EXPECT_TRUE(empty.lock() == p2);
+}
+
+TEST(atomic_weak_ptr_testing, aliased_stores_empty)
+{
+    shared_ptr<two_parts> p = make_shared<two_parts>();
+    shared_ptr<second_part> second = p;
+    atomic_weak_ptr<second_part> a(second);
+    EXPECT_TRUE(a.load().expired());
+    a.store(second);
+    EXPECT_TRUE(a.exchange(weak_ptr<second_part>()).expired());
+
+    atomic_weak_ptr<int> b(shared_ptr<int>(p, &p->second));
+    weak_ptr<int> expected;
+    EXPECT_TRUE(b.compare_exchange_strong(expected, shared_ptr<int>(p, &p->second)));
+    EXPECT_TRUE(b.load().expired());
+    EXPECT_EQ(2u, p.use_count());
+}
+
+TEST(atomic_weak_ptr_testing, observer_outlives_object)
+{
+    test_object::no_new_instances_guard g;
+    size_t live_before = live_allocations();
+    {
+        atomic_weak_ptr<test_object> a;
+        {
+            shared_ptr<test_object> p = make_shared<test_object>(42);
+            a.store(p);
+        }
+        g.expect_no_instances();
+        EXPECT_TRUE(a.load().expired());
+    }
+    EXPECT_EQ(live_before, live_allocations());
+}
+
+struct tree_node
+{
+    explicit tree_node(int key)
+        : key(key)
+    {}
+
+    int key;
+    atomic_weak_ptr<tree_node> parent;
+};
+
+TEST(atomic_weak_ptr_testing, concurrent_rotations)
+{
+    int const node_count = 16;
+    int const transient_key = 100;
+    size_t live_before = live_allocations();
+    {
+        std::vector<shared_ptr<tree_node>> nodes;
+        for (int i = 0; i != node_count; ++i)
+            nodes.push_back(make_shared<tree_node>(i));
+        for (int i = 1; i != node_count; ++i)
+            nodes[i]->parent.store(nodes[(i - 1) / 2]);
+
+        std::atomic<bool> consistent(true);
+        std::vector<std::thread> threads;
+        for (unsigned t = 0; t != 4; ++t)
+        {
+            threads.emplace_back([&, t] {
+                std::minstd_rand rng(t + 1);
+                for (size_t i = 0; i != 20000; ++i)
+                {
+                    shared_ptr<tree_node> const& a = nodes[rng() % node_count];
+                    shared_ptr<tree_node> const& b = nodes[rng() % node_count];
+                    switch (rng() % 4)
+                    {
+                    case 0: {
+                        // b takes a's place under a's parent and becomes a's parent
+                        weak_ptr<tree_node> grandparent = a->parent.load();
+                        b->parent.store(grandparent);
+                        a->parent.compare_exchange_strong(grandparent, b);
+                        break;
+                    }
+                    case 1: {
+                        shared_ptr<tree_node> p = a->parent.load().lock();
+                        if (p && !(p->key >= 0 && p->key < node_count) && p->key != transient_key)
+                            consistent = false;
+                        break;
+                    }
+                    case 2: {
+                        shared_ptr<tree_node> transient = make_shared<tree_node>(transient_key);
+                        weak_ptr<tree_node> old = a->parent.exchange(transient);
+                        a->parent.store(old);
+                        break;
+                    }
+                    default:
+                        a->parent.store(weak_ptr<tree_node>());
+                        break;
+                    }
+                }
+            });
+        }
+        for (auto& t : threads)
+            t.join();
+        EXPECT_TRUE(consistent.load());
+    }
+    EXPECT_EQ(live_before, live_allocations());
+}
+
+TEST(pointer_algorithms_testing, lock_all)
+{
+    test_object::no_new_instances_guard g;
+    std::vector<shared_ptr<test_object>> objects;
+    std::vector<weak_ptr<test_object>> observers;
+    for (int i = 0; i != 100; ++i)
+    {
+        objects.push_back(make_shared<test_object>(i));
+        observers.push_back(objects.back());
+    }
+    observers.push_back(weak_ptr<test_object>());
+    for (int i = 0; i < 100; i += 3)
+        objects[i].reset();
+
+    std::vector<shared_ptr<test_object>> locked;
+    size_t live = lock_all(std::span(observers), std::back_inserter(locked), 4);
+    EXPECT_EQ(66u, live);
+    ASSERT_EQ(66u, locked.size());
+    for (size_t i = 0; i != live; ++i)
+    {
+        EXPECT_TRUE(observers[i].lock() == locked[i]);
+        EXPECT_NE(0, *locked[i] % 3);
+        EXPECT_EQ(2, locked[i].use_count());
+    }
+    for (size_t i = live; i != observers.size(); ++i)
+        EXPECT_TRUE(observers[i].expired());
+    for (size_t i = 1; i != live; ++i)
+        EXPECT_LT(int(*locked[i - 1]), int(*locked[i]));
+}
+
+TEST(pointer_algorithms_testing, lock_all_empty)
+{
+    std::vector<weak_ptr<test_object>> observers;
+    std::vector<shared_ptr<test_object>> locked;
+    EXPECT_EQ(0u, lock_all(std::span(observers), std::back_inserter(locked)));
+    EXPECT_TRUE(locked.empty());
+}
+
+TEST(pointer_algorithms_testing, erase_expired)
+{
+    test_object::no_new_instances_guard g;
+    std::vector<shared_ptr<test_object>> objects;
+    std::vector<weak_ptr<test_object>> observers;
+    for (int i = 0; i != 103; ++i)
+    {
+        objects.push_back(make_shared<test_object>(i));
+        observers.push_back(objects.back());
+        if (i % 10 == 0)
+            observers.push_back(weak_ptr<test_object>());
+    }
+    for (int i = 0; i < 103; i += 3)
+        objects[i].reset();
+    for (int i = 40; i != 48; ++i)
+        objects[i].reset();
+
+    std::vector<shared_ptr<test_object>> alive;
+    std::copy_if(objects.begin(), objects.end(), std::back_inserter(alive),
+                 [](shared_ptr<test_object> const& o) { return static_cast<bool>(o); });
+    size_t live = alive.size();
+
+    std::vector<weak_ptr<test_object>> compacted = observers;
+    EXPECT_EQ(live, compact_expired(std::span(compacted)));
+
+    size_t size = observers.size();
+    EXPECT_EQ(size - live, erase_expired(observers));
+    ASSERT_EQ(live, observers.size());
+    for (size_t i = 0; i != live; ++i)
+    {
+        EXPECT_TRUE(observers[i].lock() == alive[i]);
+        EXPECT_TRUE(compacted[i].lock() == alive[i]);
+    }
+}
+
+TEST(pointer_algorithms_testing, erase_expired_all_live)
+{
+    std::vector<shared_ptr<int>> objects;
+    std::vector<weak_ptr<int>> observers;
+    for (int i = 0; i != 9; ++i)
+    {
+        objects.push_back(make_shared<int>(i));
+        observers.push_back(objects.back());
+    }
+    EXPECT_EQ(0u, erase_expired(observers));
+    for (int i = 0; i != 9; ++i)
+        EXPECT_EQ(i, *observers[i].lock());
+}
+
+TEST(pointer_algorithms_testing, erase_expired_deque)
+{
+    shared_ptr<int> p = make_shared<int>(42);
+    std::deque<weak_ptr<int>> observers;
+    observers.push_back(p);
+    observers.push_back(make_shared<int>(43));
+    observers.push_back(p);
+    EXPECT_EQ(1u, erase_expired(observers));
+    EXPECT_EQ(2u, observers.size());
+}
+
+TEST(pointer_algorithms_testing, erase_expired_compact_weak_ptr)
+{
+    shared_ptr<int> p = make_shared<int>(42);
+    std::vector<compact_weak_ptr<int>> observers;
+    observers.emplace_back(p);
+    observers.emplace_back(make_shared<int>(43));
+    observers.emplace_back();
+    observers.emplace_back(p);
+    EXPECT_EQ(2u, erase_expired(observers));
+    ASSERT_EQ(2u, observers.size());
+    EXPECT_EQ(p, observers[1].lock());
+}
+
+TEST(pointer_algorithms_testing, for_each_prefetched)
+{
+    test_object::no_new_instances_guard g;
+    std::vector<shared_ptr<test_object>> objects;
+    for (int i = 0; i != 50; ++i)
+        objects.push_back(i % 7 == 0 ? shared_ptr<test_object>() : make_shared<test_object>(i));
+
+    for (size_t distance : {0, 1, 8, 100})
+    {
+        std::vector<int> seen;
+        for_each_prefetched(objects, [&](shared_ptr<test_object> const& p) { seen.push_back(p ? int(*p) : -1); },
+                            distance, distance % 2 == 0);
+        ASSERT_EQ(objects.size(), seen.size());
+        for (int i = 0; i != 50; ++i)
+            EXPECT_EQ(i % 7 == 0 ? -1 : i, seen[i]);
+    }
+}
+
+TEST(pointer_algorithms_testing, for_each_prefetched_forward_range)
+{
+    std::list<shared_ptr<int>> objects;
+    for (int i = 0; i != 10; ++i)
+        objects.push_back(make_shared<int>(i));
+    int sum = 0;
+    for_each_prefetched(objects, [&](shared_ptr<int>& p) { sum += *p; }, 3);
+    EXPECT_EQ(45, sum);
+}
+
+struct graph_node
+{
+    explicit graph_node(int key)
+        : value(key)
+    {}
+
+    template <class Visitor>
+    void for_each_child(Visitor&& visit)
+    {
+        for (auto const& e : edges)
+            visit(e);
+        visit(payload);
+    }
+
+    test_object value;
+    std::vector<shared_ptr<graph_node>> edges;
+    shared_ptr<test_object> payload;
+};
+
+TEST(cycle_collector_testing, two_cycle)
+{
+    test_object::no_new_instances_guard g;
+    collect_cycles();
+    size_t live_before = live_allocations();
+    weak_ptr<graph_node> w;
+    {
+        shared_ptr<graph_node> a = make_collectable<graph_node>(1);
+        shared_ptr<graph_node> b = make_collectable<graph_node>(2);
+        a->edges.push_back(b);
+        b->edges.push_back(a);
+        w = a;
+    }
+    EXPECT_FALSE(w.expired());
+    EXPECT_EQ(2u, collect_cycles());
+    EXPECT_TRUE(w.expired());
+    g.expect_no_instances();
+    w.reset();
+    EXPECT_EQ(live_before, live_allocations());
+}
+
+TEST(cycle_collector_testing, self_cycle_with_payload)
+{
+    test_object::no_new_instances_guard g;
+    collect_cycles();
+    bool expired = false;
+    {
+        shared_ptr<graph_node> a = make_collectable<graph_node>(1);
+        a->edges.push_back(a);
+        a->payload = make_shared<test_object>(42);
+        on_expire(a, [&expired] { expired = true; });
+    }
+    EXPECT_FALSE(expired);
+    EXPECT_EQ(1u, collect_cycles());
+    EXPECT_TRUE(expired);
+    g.expect_no_instances();
+}
+
+TEST(cycle_collector_testing, live_cycle_is_kept)
+{
+    test_object::no_new_instances_guard g;
+    collect_cycles();
+    shared_ptr<graph_node> a = make_collectable<graph_node>(1);
+    {
+        shared_ptr<graph_node> b = make_collectable<graph_node>(2);
+        shared_ptr<graph_node> c = make_collectable<graph_node>(3);
+        a->edges.push_back(b);
+        b->edges.push_back(c);
+        c->edges.push_back(a);
+    }
+    EXPECT_EQ(0u, collect_cycles());
+    EXPECT_EQ(3, int(a->edges[0]->edges[0]->value));
+    EXPECT_EQ(1, int(a->edges[0]->edges[0]->edges[0]->value));
+
+    a.reset();
+    EXPECT_EQ(3u, collect_cycles());
+    g.expect_no_instances();
+}
+
+TEST(cycle_collector_testing, acyclic_garbage_is_freed_normally)
+{
+    test_object::no_new_instances_guard g;
+    collect_cycles();
+    {
+        shared_ptr<graph_node> a = make_collectable<graph_node>(1);
+        shared_ptr<graph_node> b = make_collectable<graph_node>(2);
+        a->edges.push_back(b);
+    }
+    g.expect_no_instances();
+    EXPECT_EQ(0u, collect_cycles());
+}
+
+TEST(cycle_collector_testing, long_ring)
+{
+    test_object::no_new_instances_guard g;
+    collect_cycles();
+    {
+        shared_ptr<graph_node> first = make_collectable<graph_node>(0);
+        shared_ptr<graph_node> last = first;
+        for (int i = 1; i != 100000; ++i)
+        {
+            shared_ptr<graph_node> next = make_collectable<graph_node>(i);
+            last->edges.push_back(next);
+            last = next;
+        }
+        last->edges.push_back(first);
+    }
+    EXPECT_EQ(100000u, collect_cycles());
+    g.expect_no_instances();
+}
+
+TEST(cycle_collector_testing, concurrent_release)
+{
+    test_object::no_new_instances_guard g;
+    collect_cycles();
+    for (int round = 0; round != 100; ++round)
+    {
+        std::vector<shared_ptr<graph_node>> copies(4, make_collectable<graph_node>(round));
+        std::vector<std::thread> threads;
+        for (auto& c : copies)
+            threads.emplace_back([&c] { c.reset(); });
+        for (auto& t : threads)
+            t.join();
+    }
+    EXPECT_EQ(0u, collect_cycles());
+    g.expect_no_instances();
+}
+
+TEST(lru_cache_testing, get_and_emplace)
+{
+    using cache_type = lru_cache<int, std::string>;
+    cache_type cache(100 * cache_type::entry_charge, 1);
+    EXPECT_FALSE(cache.get(1));
+    shared_ptr<std::string> one = cache.emplace(1, "one");
+    EXPECT_EQ("one", *one);
+    EXPECT_EQ(one, cache.get(1));
+    EXPECT_EQ(1u, cache.hits());
+    EXPECT_EQ(1u, cache.misses());
+    EXPECT_EQ(1u, cache.size());
+    EXPECT_EQ(cache_type::entry_charge, cache.charge());
+
+    cache.emplace(1, "uno");
+    EXPECT_EQ("uno", *cache.get(1));
+    EXPECT_EQ("one", *one);
+    EXPECT_EQ(1u, cache.size());
+}
+
+TEST(lru_cache_testing, evicted_value_stays_valid)
+{
+    test_object::no_new_instances_guard g;
+    {
+        using cache_type = lru_cache<int, test_object>;
+        cache_type cache(2 * cache_type::entry_charge, 1);
+        shared_ptr<test_object> first = cache.emplace(1, 1);
+        cache.emplace(2, 2);
+        cache.emplace(3, 3);
+        EXPECT_EQ(2u, cache.size());
+        EXPECT_FALSE(cache.get(1));
+        EXPECT_EQ(1u, first.use_count());
+        EXPECT_EQ(1, *first);
+    }
+    g.expect_no_instances();
+}
+
+TEST(lru_cache_testing, referenced_entries_get_a_second_chance)
+{
+    using cache_type = lru_cache<int, int>;
+    cache_type cache(3 * cache_type::entry_charge, 1);
+    cache.emplace(1, 1);
+    cache.emplace(2, 2);
+    cache.emplace(3, 3);
+    cache.get(1);
+    cache.emplace(4, 4);
+    EXPECT_NE(nullptr, cache.get(1));
+    EXPECT_FALSE(cache.get(2));
+    EXPECT_NE(nullptr, cache.get(3));
+    EXPECT_NE(nullptr, cache.get(4));
+    EXPECT_EQ(3 * cache_type::entry_charge, cache.charge());
+}
+
+TEST(lru_cache_testing, get_or_create_and_erase)
+{
+    lru_cache<std::string, int> cache(1 << 20);
+    int created = 0;
+    auto create = [&created] { return ++created; };
+    EXPECT_EQ(1, *cache.get_or_create("a", create));
+    EXPECT_EQ(1, *cache.get_or_create("a", create));
+    EXPECT_EQ(1, created);
+    EXPECT_TRUE(cache.erase("a"));
+    EXPECT_FALSE(cache.erase("a"));
+    EXPECT_EQ(0u, cache.size());
+    EXPECT_EQ(0u, cache.charge());
+    EXPECT_EQ(2, *cache.get_or_create("a", create));
+    cache.clear();
+    EXPECT_EQ(0u, cache.size());
+}
+
+struct size_log
+{
+    std::vector<size_t> sizes;
+};
+
+// records the size of the cache it is in when it is destroyed
+struct reentrant_value
+{
+    lru_cache<int, reentrant_value>* cache;
+    size_log* log;
+
+    ~reentrant_value()
+    {
+        log->sizes.push_back(cache->size());
+    }
+};
+
+TEST(lru_cache_testing, values_are_destroyed_outside_the_lock)
+{
+    using cache_type = lru_cache<int, reentrant_value>;
+    cache_type cache(cache_type::entry_charge, 1);
+    size_log log;
+    cache.emplace(1, &cache, &log);
+    cache.emplace(1, &cache, &log);
+    cache.emplace(2, &cache, &log);
+    cache.erase(2);
+    EXPECT_EQ((std::vector<size_t>{1, 1, 0}), log.sizes);
+}
+
+TEST(lru_cache_testing, concurrent_access)
+{
+    using cache_type = lru_cache<int, int>;
+    cache_type cache(64 * cache_type::entry_charge, 4);
+    std::atomic<size_t> mismatches(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t != 4; ++t)
+    {
+        threads.emplace_back([&cache, &mismatches, t] {
+            std::minstd_rand rng(t + 1);
+            for (int i = 0; i != 20000; ++i)
+            {
+                int key = static_cast<int>(rng() % 256);
+                shared_ptr<int> v = cache.get_or_create(key, [key] { return key; });
+                if (*v != key)
+                    mismatches.fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+    EXPECT_EQ(0u, mismatches.load());
+    EXPECT_LE(cache.charge(), cache.capacity());
+    EXPECT_EQ(80000u, cache.hits() + cache.misses());
+}
+
+TEST(future_testing, set_value_then_get)
+{
+    promise<int> p;
+    future<int> f = p.get_future();
+    EXPECT_TRUE(f.valid());
+    EXPECT_FALSE(f.is_ready());
+    p.set_value(42);
+    EXPECT_TRUE(f.is_ready());
+    EXPECT_EQ(42, f.get());
+    EXPECT_FALSE(f.valid());
+}
+
+TEST(future_testing, one_allocation)
+{
+    size_t before = live_allocations();
+    {
+        promise<std::pair<int, int>> p;
+        future<std::pair<int, int>> f = p.get_future();
+        EXPECT_EQ(before + 1, live_allocations());
+        p.set_value(1, 2);
+        EXPECT_EQ(std::make_pair(1, 2), f.get());
+    }
+    EXPECT_EQ(before, live_allocations());
+}
+
+TEST(future_testing, exception)
+{
+    promise<int> p;
+    future<int> f = p.get_future();
+    p.set_exception(std::make_exception_ptr(std::runtime_error("failed")));
+    EXPECT_THROW(f.get(), std::runtime_error);
+}
+
+TEST(future_testing, broken_promise)
+{
+    future<test_object> f;
+    {
+        promise<test_object> p;
+        f = p.get_future();
+    }
+    try
+    {
+        f.get();
+        FAIL();
+    }
+    catch (std::future_error const& e)
+    {
+        EXPECT_EQ(std::future_errc::broken_promise, e.code());
+    }
+}
+
+TEST(future_testing, misuse)
+{
+    promise<int> p;
+    future<int> f = p.get_future();
+    EXPECT_THROW(p.get_future(), std::future_error);
+    p.set_value(1);
+    EXPECT_THROW(p.set_value(2), std::future_error);
+    f.get();
+    EXPECT_THROW(f.get(), std::future_error);
+    EXPECT_THROW(f.wait(), std::future_error);
+}
+
+TEST(future_testing, wait_for)
+{
+    promise<void> p;
+    future<void> f = p.get_future();
+    EXPECT_EQ(std::future_status::timeout, f.wait_for(std::chrono::milliseconds(5)));
+    std::thread producer([&p] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        p.set_value();
+    });
+    EXPECT_EQ(std::future_status::ready, f.wait_for(std::chrono::seconds(10)));
+    f.get();
+    producer.join();
+}
+
+TEST(future_testing, wait_for_forever)
+{
+    promise<int> p;
+    future<int> f = p.get_future();
+    std::thread producer([&p] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        p.set_value(7);
+    });
+    EXPECT_EQ(std::future_status::ready, f.wait_for(std::chrono::nanoseconds::max()));
+    EXPECT_EQ(7, f.get());
+    producer.join();
+}
+
+TEST(future_testing, cross_thread)
+{
+    for (int i = 0; i != 1000; ++i)
+    {
+        promise<int> p;
+        future<int> f = p.get_future();
+        std::thread producer([&p, i] { p.set_value(i); });
+        EXPECT_EQ(i, f.get());
+        producer.join();
+    }
+}
+
+TEST(future_testing, then)
+{
+    test_object::no_new_instances_guard g;
+    {
+        promise<int> p;
+        future<test_object> chained = p.get_future()
+            .then([](future<int> f) { return f.get() * 2; })
+            .then([](future<int> f) { return test_object(f.get() + 1); });
+        EXPECT_FALSE(chained.is_ready());
+        p.set_value(20);
+        EXPECT_EQ(41, chained.get());
+    }
+    g.expect_no_instances();
+}
+
+TEST(future_testing, then_on_ready_future)
+{
+    promise<int> p;
+    p.set_value(1);
+    bool ran = false;
+    future<void> done = p.get_future().then([&ran](future<int> f) { ran = f.get() == 1; });
+    EXPECT_TRUE(ran);
+    EXPECT_TRUE(done.is_ready());
+    done.get();
+}
+
+TEST(future_testing, then_propagates_exceptions)
+{
+    future<int> chained;
+    {
+        promise<int> p;
+        chained = p.get_future().then([](future<int> f) { return f.get() + 1; });
+    }
+    EXPECT_THROW(chained.get(), std::future_error);
+
+    promise<int> p;
+    future<int> failing = p.get_future().then([](future<int>) -> int { throw std::runtime_error("failed"); });
+    p.set_value(1);
+    EXPECT_THROW(failing.get(), std::runtime_error);
+}
+
+TEST(lazy_shared_testing, constructs_on_first_get)
+{
+    test_object::no_new_instances_guard g;
+    {
+        int calls = 0;
+        lazy_shared<test_object> lazy([&calls] { return test_object(++calls); });
+        EXPECT_FALSE(lazy.is_initialized());
+        EXPECT_EQ(0, calls);
+        shared_ptr<test_object> a = lazy.get();
+        shared_ptr<test_object> b = lazy.get();
+        EXPECT_TRUE(lazy.is_initialized());
+        EXPECT_EQ(1, calls);
+        EXPECT_EQ(a, b);
+        EXPECT_EQ(1, *a);
+        EXPECT_EQ(3u, a.use_count());
+    }
+    g.expect_no_instances();
+}
+
+TEST(lazy_shared_testing, value_outlives_lazy)
+{
+    test_object::no_new_instances_guard g;
+    shared_ptr<test_object> kept;
+    weak_ptr<test_object> observer;
+    {
+        lazy_shared<test_object> lazy([] { return test_object(5); });
+        kept = lazy.get();
+        observer = kept;
+    }
+    EXPECT_EQ(5, *kept);
+    EXPECT_EQ(1u, kept.use_count());
+    kept.reset();
+    EXPECT_TRUE(observer.expired());
+    g.expect_no_instances();
+}
+
+TEST(lazy_shared_testing, never_used)
+{
+    size_t before = live_allocations();
+    {
+        lazy_shared<std::pair<int, int>> lazy([] { return std::make_pair(1, 2); });
+    }
+    EXPECT_EQ(before, live_allocations());
+}
+
+TEST(lazy_shared_testing, factory_exception_allows_retry)
+{
+    int calls = 0;
+    lazy_shared<int> lazy([&calls]() -> int {
+        if (++calls == 1)
+            throw std::runtime_error("first attempt fails");
+        return 7;
+    });
+    EXPECT_THROW(lazy.get(), std::runtime_error);
+    EXPECT_FALSE(lazy.is_initialized());
+    EXPECT_EQ(7, *lazy.get());
+    EXPECT_EQ(2, calls);
+}
+
+TEST(lazy_shared_testing, concurrent_first_access)
+{
+    for (int round = 0; round != 50; ++round)
+    {
+        std::atomic<int> calls(0);
+        lazy_shared<int> lazy([&calls] {
+            calls.fetch_add(1);
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            return 42;
+        });
+        std::vector<std::thread> threads;
+        std::atomic<int> sum(0);
+        for (int t = 0; t != 8; ++t)
+            threads.emplace_back([&] { sum += *lazy.get(); });
+        for (auto& t : threads)
+            t.join();
+        EXPECT_EQ(1, calls.load());
+        EXPECT_EQ(8 * 42, sum.load());
+    }
+}
+
+TEST(shared_ptr_testing, void_pointer)
+{
+    test_object::no_new_instances_guard g;
+    {
+        shared_ptr<test_object> p = make_shared<test_object>(3);
+        shared_ptr<void> erased = p;
+        weak_ptr<void> observer = erased;
+        EXPECT_EQ(static_cast<void*>(p.get()), erased.get());
+        EXPECT_EQ(2u, erased.use_count());
+        p.reset();
+        EXPECT_EQ(3, *static_cast<test_object*>(observer.lock().get()));
+    }
+    g.expect_no_instances();
+}
+
+TEST(atomic_shared_ptr_testing, load_store_exchange)
+{
+    test_object::no_new_instances_guard g;
+    {
+        atomic_shared_ptr<test_object> a(make_shared<test_object>(1));
+        EXPECT_EQ(1, *a.load());
+        a.store(make_shared<test_object>(2));
+        shared_ptr<test_object> two = a.exchange(make_shared<test_object>(3));
+        EXPECT_EQ(2, *two);
+        EXPECT_EQ(1u, two.use_count());
+        shared_ptr<test_object> three = a;
+        EXPECT_EQ(3, *three);
+        EXPECT_EQ(2u, three.use_count());
+        a = shared_ptr<test_object>();
+        EXPECT_FALSE(a.load());
+        EXPECT_EQ(1u, three.use_count());
+    }
+    g.expect_no_instances();
+}
+
+TEST(atomic_shared_ptr_testing, compare_exchange)
+{
+    shared_ptr<int> first = make_shared<int>(1);
+    atomic_shared_ptr<int> a(first);
+    shared_ptr<int> expected = make_shared<int>(0);
+    EXPECT_FALSE(a.compare_exchange_strong(expected, make_shared<int>(2)));
+    EXPECT_EQ(first, expected);
+    EXPECT_TRUE(a.compare_exchange_strong(expected, make_shared<int>(2)));
+    EXPECT_EQ(2, *a.load());
+    EXPECT_EQ(2u, first.use_count());
+}
+
+TEST(atomic_shared_ptr_testing, pointer_at_the_object_address)
+{
+    shared_ptr<two_parts> p = make_shared<two_parts>();
+    shared_ptr<first_part> first = p;
+    atomic_shared_ptr<first_part> a(first);
+    EXPECT_EQ(static_cast<first_part*>(p.get()), a.load().get());
+    atomic_shared_ptr<int> b(shared_ptr<int>(p, &p->first));
+    EXPECT_EQ(&p->first, b.load().get());
+    EXPECT_EQ(4u, p.use_count());
+}
+
+TEST(atomic_shared_ptr_testing, concurrent_rotations)
+{
+    size_t before = live_allocations();
+    {
+        atomic_shared_ptr<int> a(make_shared<int>(0));
+        std::atomic<bool> failed(false);
+        std::vector<std::thread> threads;
+        for (int t = 0; t != 4; ++t)
+        {
+            threads.emplace_back([&a, &failed, t] {
+                for (int i = 0; i != 20000; ++i)
+                {
+                    if (t % 2 == 0)
+                    {
+                        a.store(make_shared<int>(i));
+                    }
+                    else if (shared_ptr<int> p = a.load())
+                    {
+                        if (*p < 0 || p.use_count() == 0)
+                            failed = true;
+                    }
+                }
+            });
+        }
+        for (auto& t : threads)
+            t.join();
+        EXPECT_FALSE(failed.load());
+    }
+    EXPECT_EQ(before, live_allocations());
+}
+
+struct listener
+{
+    int total = 0;
+};
+
+TEST(event_signal_testing, emit_to_subscribers)
+{
+    event_signal<void(int)> changed;
+    shared_ptr<listener> a = make_shared<listener>();
+    shared_ptr<listener> b = make_shared<listener>();
+    changed.subscribe(a, [](listener& l, int v) { l.total += v; });
+    event_signal<void(int)>::connection second = changed.subscribe(b, [](listener& l, int v) { l.total += 2 * v; });
+    EXPECT_EQ(2u, changed.emit(5));
+    EXPECT_EQ(5, a->total);
+    EXPECT_EQ(10, b->total);
+
+    EXPECT_TRUE(changed.unsubscribe(second));
+    EXPECT_FALSE(changed.unsubscribe(second));
+    EXPECT_EQ(1u, changed.emit(1));
+    EXPECT_EQ(6, a->total);
+    EXPECT_EQ(10, b->total);
+}
+
+TEST(event_signal_testing, expired_subscribers_are_pruned)
+{
+    test_object::no_new_instances_guard g;
+    {
+        event_signal<void(int)> changed;
+        shared_ptr<test_object> kept = make_shared<test_object>(1);
+        shared_ptr<test_object> dropped = make_shared<test_object>(2);
+        int calls = 0;
+        changed.subscribe(kept, [&calls](test_object&, int) { ++calls; });
+        changed.subscribe(dropped, [&calls](test_object&, int) { ++calls; });
+        dropped.reset();
+        EXPECT_EQ(2u, changed.size());
+        EXPECT_EQ(1u, changed.emit(0));
+        EXPECT_EQ(1u, changed.size());
+        EXPECT_EQ(1, calls);
+    }
+    g.expect_no_instances();
+}
+
+TEST(event_signal_testing, concurrent_emit_and_subscribe)
+{
+    event_signal<void(int)> changed;
+    std::atomic<bool> stop(false);
+    std::vector<std::thread> emitters;
+    std::atomic<size_t> delivered(0);
+    for (int t = 0; t != 2; ++t)
+    {
+        emitters.emplace_back([&] {
+            while (!stop.load())
+                delivered += changed.emit(1);
+        });
+    }
+    std::vector<shared_ptr<listener>> listeners;
+    for (int i = 0; i != 200; ++i)
+    {
+        listeners.push_back(make_shared<listener>());
+        changed.subscribe(listeners.back(), [](listener&, int) {});
+        if (i % 3 == 0)
+            listeners[i / 2].reset();
+    }
+    stop = true;
+    for (auto& t : emitters)
+        t.join();
+    changed.emit(1);
+    size_t live = static_cast<size_t>(std::count_if(listeners.begin(), listeners.end(),
+                                                    [](shared_ptr<listener> const& l) { return l != nullptr; }));
+    EXPECT_EQ(live, changed.size());
+}
+
+TEST(hamt_testing, matches_unordered_map)
+{
+    hamt_map<int, int> map;
+    std::unordered_map<int, int> expected;
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<int> keys(0, 4000);
+    for (int i = 0; i != 20000; ++i)
+    {
+        int key = keys(rng);
+        if (rng() % 3 == 0)
+        {
+            EXPECT_EQ(expected.erase(key) == 1, map.erase(key));
+        }
+        else
+        {
+            EXPECT_EQ(expected.insert_or_assign(key, i).second, map.insert_or_assign(key, i));
+        }
+    }
+    EXPECT_EQ(expected.size(), map.size());
+    for (auto const& [key, value] : expected)
+    {
+        int const* found = map.find(key);
+        ASSERT_NE(nullptr, found);
+        EXPECT_EQ(value, *found);
+    }
+    size_t visited = 0;
+    map.for_each([&](int key, int value) {
+        EXPECT_EQ(expected.at(key), value);
+        ++visited;
+    });
+    EXPECT_EQ(expected.size(), visited);
+}
+
+TEST(hamt_testing, snapshots_are_unaffected)
+{
+    hamt_map<int, std::string> map;
+    for (int i = 0; i != 1000; ++i)
+        map.insert_or_assign(i, std::to_string(i));
+
+    hamt_map<int, std::string> snapshot = map;
+    for (int i = 0; i != 1000; i += 2)
+        map.erase(i);
+    map.insert_or_assign(1, "one");
+    map.insert_or_assign(5000, "new");
+
+    EXPECT_EQ(1000u, snapshot.size());
+    for (int i = 0; i != 1000; ++i)
+    {
+        ASSERT_NE(nullptr, snapshot.find(i));
+        EXPECT_EQ(std::to_string(i), *snapshot.find(i));
+    }
+    EXPECT_FALSE(snapshot.contains(5000));
+    EXPECT_EQ(501u, map.size());
+    EXPECT_EQ("one", *map.find(1));
+    EXPECT_FALSE(map.contains(2));
+}
+
+TEST(hamt_testing, updates_unshared_nodes_in_place)
+{
+    hamt_map<int, int> map;
+    for (int i = 0; i != 1000; ++i)
+        map.insert_or_assign(i, i);
+
+    int const* before = map.find(123);
+    map.insert_or_assign(123, -1);
+    EXPECT_EQ(before, map.find(123));
+    EXPECT_EQ(-1, *map.find(123));
+
+    hamt_map<int, int> snapshot = map;
+    map.insert_or_assign(123, -2);
+    EXPECT_NE(before, map.find(123));
+    EXPECT_EQ(before, snapshot.find(123));
+    EXPECT_EQ(-1, *snapshot.find(123));
+}
+
+namespace
+{
+    // sends every key to the same slot at each level
+    struct colliding_hash
+    {
+        size_t operator()(int key) const
+        {
+            return static_cast<size_t>(key % 2);
+        }
+    };
+}
+
+TEST(hamt_testing, full_hash_collisions)
+{
+    hamt_map<int, int, colliding_hash> map;
+    for (int i = 0; i != 100; ++i)
+        EXPECT_TRUE(map.insert_or_assign(i, i));
+    EXPECT_FALSE(map.insert_or_assign(42, 0));
+
+    hamt_map<int, int, colliding_hash> snapshot = map;
+    for (int i = 0; i < 100; i += 3)
+        EXPECT_TRUE(map.erase(i));
+    EXPECT_FALSE(map.erase(3));
+
+    for (int i = 0; i != 100; ++i)
+    {
+        EXPECT_EQ(i % 3 != 0, map.contains(i));
+        ASSERT_NE(nullptr, snapshot.find(i));
+        EXPECT_EQ(i == 42 ? 0 : i, *snapshot.find(i));
+    }
+    EXPECT_EQ(66u, map.size());
+}
+
+TEST(slot_map_testing, shared_handle_ownership)
+{
+    slot_map<std::string> map;
+    shared_handle<std::string> a = map.emplace("first");
+    EXPECT_EQ(1u, a.use_count());
+    {
+        shared_handle<std::string> b = a;
+        EXPECT_EQ(2u, a.use_count());
+        EXPECT_TRUE(b == a);
+        shared_handle<std::string> c = std::move(b);
+        EXPECT_FALSE(b);
+        EXPECT_EQ(2u, c.use_count());
+        EXPECT_EQ("first", *c);
+    }
+    EXPECT_EQ(1u, a.use_count());
+    EXPECT_EQ(1u, map.size());
+    a.reset();
+    EXPECT_EQ(0u, map.size());
+}
+
+TEST(slot_map_testing, weak_handle_expires_across_slot_reuse)
+{
+    slot_map<int> map;
+    shared_handle<int> a = map.emplace(1);
+    weak_handle<int> weak = a;
+    EXPECT_FALSE(weak.expired());
+    EXPECT_EQ(1, *weak.lock());
+
+    uint32_t slot = a.slot();
+    a.reset();
+    EXPECT_TRUE(weak.expired());
+    EXPECT_FALSE(weak.lock());
+
+    shared_handle<int> b = map.emplace(2);
+    EXPECT_EQ(slot, b.slot());
+    EXPECT_TRUE(weak.expired());
+    EXPECT_EQ(0u, weak.use_count());
+}
+
+TEST(slot_map_testing, storage_stays_dense)
+{
+    slot_map<int> map;
+    std::vector<shared_handle<int>> handles;
+    for (int i = 0; i != 100; ++i)
+        handles.push_back(map.emplace(i));
+    for (size_t i = 0; i < handles.size(); i += 2)
+        handles[i].reset();
+
+    EXPECT_EQ(50u, map.size());
+    int sum = 0;
+    for (int value : map.values())
+        sum += value;
+    EXPECT_EQ(2500, sum);
+    for (size_t i = 1; i < handles.size(); i += 2)
+        EXPECT_EQ(static_cast<int>(i), *handles[i]);
+}
+
+namespace
+{
+    struct slot_node
+    {
+        int value;
+        shared_handle<slot_node> next;
+    };
+}
+
+TEST(slot_map_testing, throwing_constructor_leaves_map_unchanged)
+{
+    slot_map<throwing_on_negative> map;
+    EXPECT_THROW(map.emplace(-1), std::runtime_error);
+    EXPECT_EQ(0u, map.size());
+    shared_handle<throwing_on_negative> a = map.emplace(1);
+    EXPECT_EQ(0u, a.slot());
+    EXPECT_THROW(map.emplace(-1), std::runtime_error);
+    shared_handle<throwing_on_negative> b = map.emplace(2);
+    EXPECT_EQ(1u, b.slot());
+    EXPECT_EQ(2u, map.size());
+}
+
+TEST(slot_map_testing, destructor_releases_other_handles)
+{
+    slot_map<slot_node> map;
+    shared_handle<slot_node> head;
+    for (int i = 0; i != 10; ++i)
+        head = map.emplace(slot_node{i, std::move(head)});
+    shared_handle<slot_node> other = map.emplace(slot_node{-1, {}});
+    EXPECT_EQ(11u, map.size());
+
+    head.reset();
+    EXPECT_EQ(1u, map.size());
+    EXPECT_EQ(-1, other->value);
+    other.reset();
+    EXPECT_EQ(0u, map.size());
+}
+
+namespace
+{
+    table sample_table(size_t rows)
+    {
+        return table()
+            .with_column("id", make_column<int64_t>(rows, [](size_t i) { return static_cast<int64_t>(i); }))
+            .with_column("price", make_column<double>(rows, [](size_t i) { return 0.5 * static_cast<double>(i); }))
+            .with_column("in_stock", make_column<bool>(rows, [](size_t i) { return i % 3 != 0; }));
+    }
+}
+
+TEST(column_table_testing, projection_shares_columns)
+{
+    table t = sample_table(100);
+    table projected = t.select({"price", "id"});
+    EXPECT_EQ(2u, projected.column_count());
+    EXPECT_EQ(100u, projected.rows());
+    EXPECT_EQ(t.get<double>("price").get(), projected.get<double>("price").get());
+    EXPECT_EQ(t.get<int64_t>("id").get(), projected.get<int64_t>("id").get());
+
+    table dropped = t.without("id");
+    EXPECT_FALSE(dropped.contains("id"));
+    EXPECT_EQ(t.get<bool>("in_stock").get(), dropped.get<bool>("in_stock").get());
+}
+
+TEST(column_table_testing, transform_materializes_only_the_changed_column)
+{
+    table t = sample_table(100);
+    table discounted = t.transform<double>("price", [](double price) { return price * 0.9; });
+    EXPECT_NE(t.get<double>("price").get(), discounted.get<double>("price").get());
+    EXPECT_EQ(t.get<int64_t>("id").get(), discounted.get<int64_t>("id").get());
+    EXPECT_DOUBLE_EQ(0.45, (*discounted.get<double>("price"))[1]);
+    EXPECT_DOUBLE_EQ(0.5, (*t.get<double>("price"))[1]);
+
+    table labelled = t.transform<int64_t>("id", [](int64_t id) { return std::to_string(id); });
+    EXPECT_EQ("42", (*labelled.get<std::string>("id"))[42]);
+}
+
+TEST(column_table_testing, filter_gathers_rows)
+{
+    table t = sample_table(99);
+    table in_stock = t.filter(*t.get<bool>("in_stock"));
+    EXPECT_EQ(66u, in_stock.rows());
+    auto ids = in_stock.get<int64_t>("id");
+    EXPECT_EQ(1, (*ids)[0]);
+    EXPECT_EQ(2, (*ids)[1]);
+    EXPECT_EQ(4, (*ids)[2]);
+
+    table unchanged = in_stock.filter(*in_stock.get<bool>("in_stock"));
+    EXPECT_EQ(ids.get(), unchanged.get<int64_t>("id").get());
+}
+
+TEST(column_table_testing, aligned_storage_and_errors)
+{
+    table t = sample_table(10);
+    EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(t.get<double>("price")->data()) % column_alignment);
+    EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(t.get<int64_t>("id")->data()) % column_alignment);
+
+    EXPECT_THROW(t.get<double>("missing"), std::out_of_range);
+    EXPECT_THROW(t.get<int>("price"), std::invalid_argument);
+    EXPECT_THROW(t.with_column("short", make_column<double>(5, [](size_t) { return 0.0; })), std::invalid_argument);
+}
+
+TEST(embedded_control_block_testing, shares_without_allocating)
+{
+    static int value = 7;
+    int disposed = 0;
+    int released = 0;
+    auto block = make_embedded_block<int>([&disposed](int*) { ++disposed; }, [&released](int*) { ++released; });
+
+    size_t before = allocations.load();
+    {
+        shared_ptr<int> p = share_embedded(block, &value);
+        shared_ptr<int> copy = p;
+        weak_ptr<int> weak = p;
+        EXPECT_EQ(2u, p.use_count());
+        EXPECT_EQ(7, *weak.lock());
+    }
+    EXPECT_EQ(before, allocations.load());
+    EXPECT_EQ(1, disposed);
+    EXPECT_EQ(1, released);
+
+    // the released block can share again
+    shared_ptr<int> again = share_embedded(block, &value);
+    EXPECT_EQ(1u, again.use_count());
+    again.reset();
+    EXPECT_EQ(2, disposed);
+    EXPECT_EQ(2, released);
+}
+
+namespace
+{
+    struct pooled_object
+    {
+        explicit pooled_object(int id)
+            : id(id)
+        {}
+
+        int id;
+        bool alive = true;
+        bool storage_free = false;
+        embedded_control_block<pooled_object, void (*)(pooled_object*), void (*)(pooled_object*)> block{
+            [](pooled_object* o) { o->alive = false; }, [](pooled_object* o) { o->storage_free = true; }};
+    };
+}
+
+TEST(embedded_control_block_testing, weak_observers_outlive_the_object)
+{
+    pooled_object object(3);
+    weak_ptr<pooled_object> observer;
+    {
+        shared_ptr<pooled_object> owner = share_embedded(object.block, &object);
+        observer = owner;
+        EXPECT_EQ(3, observer.lock()->id);
+    }
+    EXPECT_FALSE(object.alive);
+    EXPECT_FALSE(object.storage_free);
+    EXPECT_TRUE(observer.expired());
+    EXPECT_EQ(nullptr, observer.lock());
+
+    weak_ptr<pooled_object> second = observer;
+    observer.reset();
+    EXPECT_FALSE(object.storage_free);
+    second.reset();
+    EXPECT_TRUE(object.storage_free);
+}
+
+TEST(embedded_control_block_testing, object_in_preallocated_buffer)
+{
+    alignas(test_object) unsigned char buffer[sizeof(test_object)];
+    bool released = false;
+    auto block = make_embedded_block<test_object>(destroy_in_place(), [&released](test_object*) { released = true; });
+
+    test_object::no_new_instances_guard g;
+    test_object* object = new (buffer) test_object(1);
+    {
+        shared_ptr<test_object> p = share_embedded(block, object);
+        weak_ptr<test_object> weak = p;
+        p.reset();
+        g.expect_no_instances();
+        EXPECT_FALSE(released);
+    }
+    EXPECT_TRUE(released);
+}
+
+namespace
+{
+    // a file in the temporary directory, named after the process so that
+    // test binaries running in parallel do not share it, removed on scope
+    // exit
+    struct temp_file
+    {
+        explicit temp_file(char const* name)
+            : path((std::filesystem::temp_directory_path() / (std::to_string(getpid()) + "." + name)).string())
+        {}
+
+        ~temp_file()
+        {
+            std::remove(path.c_str());
+        }
+
+        char const* c_str() const
+        {
+            return path.c_str();
+        }
+
+        std::string path;
+    };
+}
+
+TEST(trace_recorder_testing, round_trip)
+{
+    temp_file path("round_trip.trace");
+    ASSERT_TRUE(trace_recorder::start(path.c_str()));
+    trace_recorder::record(7, trace_op::create);
+    trace_recorder::record(7, trace_op::add_shared);
+    std::thread([] {
+        for (uint64_t i = 0; i != 2 * trace_recorder::chunk_records + 1; ++i)
+            trace_recorder::record(i, trace_op::add_weak);
+    }).join();
+    trace_recorder::record(7, trace_op::release_shared);
+    trace_recorder::stop();
+    trace_recorder::record(7, trace_op::lock);
+
+    std::vector<trace_thread_log> logs = read_trace(path.c_str());
+    ASSERT_EQ(2u, logs.size());
+    EXPECT_NE(logs[0].thread, logs[1].thread);
+
+    std::vector<trace_record> const& recorder = logs[0].records.size() == 3 ? logs[0].records : logs[1].records;
+    std::vector<trace_record> const& worker = logs[0].records.size() == 3 ? logs[1].records : logs[0].records;
+    ASSERT_EQ(3u, recorder.size());
+    EXPECT_EQ(7u, recorder[0].block());
+    EXPECT_EQ(trace_op::create, recorder[0].op());
+    EXPECT_EQ(trace_op::add_shared, recorder[1].op());
+    EXPECT_EQ(trace_op::release_shared, recorder[2].op());
+    ASSERT_EQ(2 * trace_recorder::chunk_records + 1, worker.size());
+    for (size_t i = 0; i != worker.size(); ++i)
+    {
+        ASSERT_EQ(i, worker[i].block());
+        ASSERT_EQ(trace_op::add_weak, worker[i].op());
+    }
+}
+
+TEST(trace_recorder_testing, malformed)
+{
+    temp_file path("malformed.trace");
+    std::FILE* file = std::fopen(path.c_str(), "wb");
+    ASSERT_NE(nullptr, file);
+    std::fwrite(trace_magic, 1, sizeof(trace_magic), file);
+    uint32_t header[2] = {0, 4};
+    std::fwrite(header, sizeof(header), 1, file);
+    std::fclose(file);
+
+    EXPECT_THROW(read_trace(path.c_str()), std::runtime_error);
+}
+
+#if defined(SHARED_PTR_TRACE)
+TEST(trace_recorder_testing, pointer_operations)
+{
+    temp_file path("pointer_operations.trace");
+    ASSERT_TRUE(trace_recorder::start(path.c_str()));
+    weak_ptr<int> w;
+    {
+        shared_ptr<int> p = make_shared<int>(1);
+        shared_ptr<int> q = p;
+        w = q;
+        shared_ptr<int> r = std::move(q);
+        shared_ptr<int> l = w.lock();
+    }
+    EXPECT_FALSE(w.lock());
+    w.reset();
+    trace_recorder::stop();
+
+    std::vector<trace_thread_log> logs = read_trace(path.c_str());
+    ASSERT_EQ(1u, logs.size());
+    std::vector<trace_op> expected = {
+        trace_op::create, trace_op::add_shared, trace_op::add_shared, trace_op::add_weak,
+        trace_op::move, trace_op::lock, trace_op::release_shared, trace_op::release_shared,
+        trace_op::release_shared, trace_op::lock_failed, trace_op::release_weak,
+    };
+    ASSERT_EQ(expected.size(), logs[0].records.size());
+    for (size_t i = 0; i != expected.size(); ++i)
+    {
+        EXPECT_EQ(expected[i], logs[0].records[i].op());
+        EXPECT_EQ(logs[0].records[0].block(), logs[0].records[i].block());
+    }
+}
+#endif
+
 int main(int argc, char** argv)
 {
     testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <utility>
+
+// Exception-free mode, chosen when the compiler has exceptions disabled
+// (-fno-exceptions) or SHARED_PTR_NO_EXCEPTIONS is defined. Blocks are then
+// allocated with nothrow new, and a failed allocation calls the allocation
+// failure handler instead of throwing std::bad_alloc; the default handler
+// aborts, and if a handler returns, the pointer being created is left
+// empty. Converting an expired weak_ptr gives an empty pointer instead of
+// throwing std::bad_weak_ptr.
+//
+// SHARED_PTR_NO_EXCEPTIONS only changes how the library itself reports
+// failures: exceptions thrown by the objects it constructs still propagate,
+// and are cleaned up after, as long as the compiler has exceptions enabled.
+//
+// try_make_shared reports allocation failure with an empty pointer in
+// either mode, without calling the handler.
+#if defined(__cpp_exceptions)
+#define SHARED_PTR_HAS_EXCEPTIONS 1
+#else
+#define SHARED_PTR_HAS_EXCEPTIONS 0
+#endif
+
+#if defined(SHARED_PTR_NO_EXCEPTIONS) || !SHARED_PTR_HAS_EXCEPTIONS
+#define SHARED_PTR_EXCEPTIONS 0
+#else
+#define SHARED_PTR_EXCEPTIONS 1
+#endif
+
+// try/catch (...)/throw; that compile without exceptions, where the handler
+// is dead code
+#if SHARED_PTR_HAS_EXCEPTIONS
+#define SHARED_PTR_TRY try
+#define SHARED_PTR_CATCH_ALL catch (...)
+#define SHARED_PTR_RETHROW throw
+#else
+#define SHARED_PTR_TRY if (true)
+#define SHARED_PTR_CATCH_ALL if (false)
+#define SHARED_PTR_RETHROW ((void)0)
+#endif
+
+using allocation_failure_handler = void (*)() noexcept;
+
+inline void abort_on_allocation_failure() noexcept {
+  std::abort();
+}
+
+inline std::atomic<allocation_failure_handler>& current_allocation_failure_handler() noexcept {
+  static std::atomic<allocation_failure_handler> handler{abort_on_allocation_failure};
+  return handler;
+}
+
+// returns the previous handler; null restores the default
+inline allocation_failure_handler set_allocation_failure_handler(allocation_failure_handler h) noexcept {
+  return current_allocation_failure_handler().exchange(h != nullptr ? h : abort_on_allocation_failure);
+}
+
+[[gnu::cold]] inline void report_allocation_failure() noexcept {
+  current_allocation_failure_handler().load()();
+}
+
+// new Block(args...), or nothrow new in the exception-free mode, where a
+// null result has to be checked for
+template <class Block, class... Args>
+Block* new_block(Args&&... args) {
+#if SHARED_PTR_EXCEPTIONS
+  return new Block(std::forward<Args>(args)...);
+#else
+  return new (std::nothrow) Block(std::forward<Args>(args)...);
+#endif
+}
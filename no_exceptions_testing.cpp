@@ -0,0 +1,258 @@
+#include <gtest/gtest.h>
+#include "shared_ptr.h"
+#include "weighted_ptr.h"
+#include "compact_weak_ptr.h"
+#include "atomic_weak_ptr.h"
+#include "slot_map.h"
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+// The core pointer types in the exception-free mode, built once with
+// -fno-exceptions and once with SHARED_PTR_NO_EXCEPTIONS and exceptions
+// enabled: allocation failures reach the allocation failure handler, or an
+// empty try_make_shared result, and in the second build exceptions from
+// the objects themselves are still cleaned up after.
+
+static_assert(!SHARED_PTR_EXCEPTIONS, "this file must be built in the exception-free mode");
+
+namespace
+{
+    std::atomic<bool> fail_allocations(false);
+    std::atomic<int> reported_failures(0);
+
+    void count_failure() noexcept
+    {
+        reported_failures.fetch_add(1);
+    }
+
+    struct failing_allocations
+    {
+        failing_allocations()
+        {
+            reported_failures = 0;
+            previous = set_allocation_failure_handler(count_failure);
+            fail_allocations = true;
+        }
+
+        ~failing_allocations()
+        {
+            fail_allocations = false;
+            set_allocation_failure_handler(previous);
+        }
+
+        allocation_failure_handler previous;
+    };
+}
+
+// every form is replaced, so that each allocation is freed by its
+// counterpart
+void* operator new(std::size_t size, std::nothrow_t const&) noexcept
+{
+    if (fail_allocations.load())
+        return nullptr;
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+void* operator new(std::size_t size, std::align_val_t align, std::nothrow_t const&) noexcept
+{
+    if (fail_allocations.load())
+        return nullptr;
+    size_t alignment = static_cast<size_t>(align);
+    return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+void* operator new(std::size_t size)
+{
+    if (void* p = std::malloc(size == 0 ? 1 : size))
+        return p;
+    std::abort();
+}
+
+void* operator new(std::size_t size, std::align_val_t align)
+{
+    size_t alignment = static_cast<size_t>(align);
+    if (void* p = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment))
+        return p;
+    std::abort();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::nothrow_t const&) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t, std::nothrow_t const&) noexcept
+{
+    std::free(p);
+}
+
+TEST(no_exceptions_testing, pointers_work_as_usual)
+{
+    shared_ptr<int> p = make_shared<int>(5);
+    weak_ptr<int> w = p;
+    EXPECT_EQ(5, *w.lock());
+    p.reset_emplace(6);
+    EXPECT_EQ(6, *p);
+
+    auto [a, b] = make_shared_group<int, double>(std::make_tuple(1), std::make_tuple(2.0));
+    EXPECT_EQ(1, *a);
+    auto message = make_shared_with_trailing<int, char>(4, 9);
+    EXPECT_EQ(9, *message.header);
+    EXPECT_EQ(4u, message.trailing.size());
+}
+
+TEST(no_exceptions_testing, allocation_failure_calls_the_handler)
+{
+    bool deleted = false;
+    int* object = new int(1);
+    {
+        failing_allocations failing;
+        EXPECT_EQ(nullptr, make_shared<int>(1));
+        EXPECT_EQ(1, reported_failures.load());
+
+        shared_ptr<int> owner(object, [&deleted](int* p) {
+            deleted = true;
+            delete p;
+        });
+        EXPECT_EQ(nullptr, owner);
+        EXPECT_TRUE(deleted);
+        EXPECT_EQ(2, reported_failures.load());
+
+        auto message = make_shared_with_trailing<int, char>(16);
+        EXPECT_EQ(nullptr, message.header);
+        EXPECT_EQ(3, reported_failures.load());
+    }
+    EXPECT_NE(nullptr, make_shared<int>(1));
+}
+
+TEST(no_exceptions_testing, oversized_trailing_calls_the_handler)
+{
+    reported_failures = 0;
+    allocation_failure_handler previous = set_allocation_failure_handler(count_failure);
+    auto message = make_shared_with_trailing<int, double>(SIZE_MAX / sizeof(double));
+    set_allocation_failure_handler(previous);
+    EXPECT_EQ(nullptr, message.header);
+    EXPECT_EQ(1, reported_failures.load());
+}
+
+TEST(no_exceptions_testing, try_make_shared_returns_empty)
+{
+    {
+        failing_allocations failing;
+        EXPECT_EQ(nullptr, try_make_shared<int>(1));
+        EXPECT_EQ(0, reported_failures.load());
+    }
+    shared_ptr<int> p = try_make_shared<int>(2);
+    ASSERT_NE(nullptr, p);
+    EXPECT_EQ(2, *p);
+}
+
+TEST(no_exceptions_testing, expired_weak_converts_to_empty)
+{
+    weak_ptr<int> w = make_shared<int>(1);
+    shared_ptr<int> p(w);
+    EXPECT_EQ(nullptr, p);
+    EXPECT_EQ(0u, p.use_count());
+}
+
+#if SHARED_PTR_HAS_EXCEPTIONS
+namespace
+{
+    std::atomic<int> live_objects(0);
+
+    struct throwing_on_negative
+    {
+        explicit throwing_on_negative(int x)
+        {
+            if (x < 0)
+                throw x;
+            live_objects.fetch_add(1);
+        }
+
+        throwing_on_negative(throwing_on_negative&&) noexcept
+        {
+            live_objects.fetch_add(1);
+        }
+
+        throwing_on_negative& operator=(throwing_on_negative&&) noexcept = default;
+
+        ~throwing_on_negative()
+        {
+            live_objects.fetch_sub(1);
+        }
+    };
+
+    // fails when the control block copies it in
+    struct throwing_copy_deleter
+    {
+        bool* deleted;
+
+        throwing_copy_deleter(bool* deleted)
+            : deleted(deleted)
+        {}
+
+        throwing_copy_deleter(throwing_copy_deleter const&)
+        {
+            throw 0;
+        }
+
+        throwing_copy_deleter(throwing_copy_deleter&&) noexcept = default;
+
+        void operator()(int* p) const
+        {
+            *deleted = true;
+            delete p;
+        }
+    };
+}
+
+TEST(no_exceptions_testing, object_exceptions_are_cleaned_up)
+{
+    {
+        shared_ptr<throwing_on_negative> p = make_shared<throwing_on_negative>(1);
+        EXPECT_THROW(p.reset_emplace(-1), int);
+        EXPECT_EQ(nullptr, p);
+        EXPECT_EQ(0, live_objects.load());
+
+        EXPECT_THROW((make_shared_with_trailing<throwing_on_negative, int>(4, -1)), int);
+
+        bool deleted = false;
+        EXPECT_THROW(shared_ptr<int>(new int(1), throwing_copy_deleter{&deleted}), int);
+        EXPECT_TRUE(deleted);
+
+        slot_map<throwing_on_negative> map;
+        EXPECT_THROW(map.emplace(-1), int);
+        shared_handle<throwing_on_negative> h = map.emplace(1);
+        EXPECT_EQ(0u, h.slot());
+    }
+    EXPECT_EQ(0, live_objects.load());
+}
+#endif
+
+int main(int argc, char** argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <ranges>
+#include <span>
+#include <shared_ptr.h>
+
+inline void prefetch_for_write(const void* address) noexcept {
+#if defined(__GNUC__)
+  __builtin_prefetch(address, 1);
+#else
+  (void)address;
+#endif
+}
+
+inline void prefetch_for_read(const void* address) noexcept {
+#if defined(__GNUC__)
+  __builtin_prefetch(address, 0);
+#else
+  (void)address;
+#endif
+}
+
+// Locks every observer in items and writes the live objects to out.
+// Expired and empty observers are compacted away in the same pass: the live
+// ones keep their order at the front of items and their count is returned,
+// the tail only holds dead entries for the caller to erase. Control blocks
+// are prefetched `distance` elements ahead, so their cache misses overlap
+// instead of each lock stalling on its own.
+template <class T, class OutputIt>
+size_t lock_all(std::span<weak_ptr<T>> items, OutputIt out, size_t distance = 8) {
+  size_t live = 0;
+  for (size_t i = 0; i != items.size(); ++i) {
+    if (i + distance < items.size()) {
+      if (control_block* ahead = ptr_access::control(items[i + distance])) {
+        prefetch_for_write(ahead);
+      }
+    }
+
+    control_block* c = ptr_access::control(items[i]);
+    if (c == nullptr || !c->try_add_shared()) {
+      continue;
+    }
+    *out++ = ptr_access::adopt(c, ptr_access::get(items[i]));
+    if (live != i) {
+      items[live] = std::move(items[i]);
+    }
+    ++live;
+  }
+  return live;
+}
+
+// Moves the live observers to the front of items, keeping their order, and
+// returns their count; the tail only holds expired or empty entries
+template <class T>
+size_t compact_expired(std::span<weak_ptr<T>> items) {
+  auto last = std::remove_if(items.begin(), items.end(), [](const weak_ptr<T>& w) { return w.expired(); });
+  return static_cast<size_t>(last - items.begin());
+}
+
+// erases expired and empty weak pointers from c, any range of pointers
+// with an expired() member, and returns how many were erased
+template <class Container>
+size_t erase_expired(Container& c) {
+  auto first = std::begin(c);
+  auto last = std::end(c);
+  auto live_end = std::remove_if(first, last, [](const auto& w) { return w.expired(); });
+  size_t erased = static_cast<size_t>(std::distance(live_end, last));
+  c.erase(live_end, last);
+  return erased;
+}
+
+// Calls f on every element of a range of shared_ptrs, prefetching the
+// object `distance` elements ahead, and its control block as well when
+// prefetch_control is set, so that the misses of later elements overlap
+// with the work on the current one
+template <class Range, class F>
+F for_each_prefetched(Range&& range, F f, size_t distance = 8, bool prefetch_control = false) {
+  auto it = std::ranges::begin(range);
+  auto last = std::ranges::end(range);
+  auto ahead = it;
+  for (size_t i = 0; i != distance && ahead != last; ++i) {
+    ++ahead;
+  }
+  for (; it != last; ++it) {
+    if (ahead != last) {
+      prefetch_for_read(ahead->get());
+      if (prefetch_control) {
+        prefetch_for_read(ptr_access::control(*ahead));
+      }
+      ++ahead;
+    }
+    f(*it);
+  }
+  return f;
+}
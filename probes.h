@@ -0,0 +1,18 @@
+#pragma once
+
+// USDT probes on control block lifecycle events under the "shared_ptr"
+// provider, for perf and bpftrace. Each probe takes the control block
+// address. Without <sys/sdt.h>, or with SHARED_PTR_NO_PROBES defined, they
+// compile to nothing; with it, an unattached probe is a single nop.
+#if !defined(SHARED_PTR_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define SHARED_PTR_HAS_PROBES 1
+#endif
+#endif
+
+#if defined(SHARED_PTR_HAS_PROBES)
+#define SHARED_PTR_PROBE(name, block) DTRACE_PROBE1(shared_ptr, name, block)
+#else
+#define SHARED_PTR_PROBE(name, block) ((void)(block))
+#endif
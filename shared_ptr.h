@@ -1,10 +1,49 @@
 #pragma once
 
 #include <control_block.h>
+#include <span>
+#include <typeinfo>
 
 template <typename T>
 struct weak_ptr;
 
+template <typename T>
+struct shared_ptr;
+
+template <class T, class... Args>
+shared_ptr<T> make_shared(Args&&... args);
+
+template <typename T>
+struct weighted_ptr;
+
+template <typename T>
+struct compact_weak_ptr;
+
+template <typename T>
+struct atomic_weak_ptr;
+
+template <typename T>
+struct atomic_shared_ptr;
+
+struct ptr_access;
+
+template <typename Header, typename Elem>
+struct shared_with_trailing;
+
+// deleter of the uniquely owned handles produced by try_take_unique: the
+// object is released through its control block, which goes away with it
+struct control_block_deleter {
+  control_block* control = nullptr;
+
+  template <class T>
+  void operator()(T*) const noexcept {
+    control->release_shared();
+  }
+};
+
+template <typename T>
+using unique_shared_ptr = std::unique_ptr<T, control_block_deleter>;
+
 template <typename T>
 struct shared_ptr {
   // constructors
@@ -17,11 +56,17 @@ struct shared_ptr {
 
   template <class Y, class Deleter>
   shared_ptr(Y* p, Deleter d) {
-    try {
-      control = new not_init_block<Y, Deleter>(p, d);
-    } catch (...) {
+    SHARED_PTR_TRY {
+      control = new_block<not_init_block<Y, Deleter>>(p, d);
+    } SHARED_PTR_CATCH_ALL {
       d(p);
-      throw;
+      SHARED_PTR_RETHROW;
+    }
+    if (control == nullptr) {
+      d(p);
+      ptr = nullptr;
+      report_allocation_failure();
+      return;
     }
     ptr = p;
 
@@ -40,6 +85,7 @@ struct shared_ptr {
   shared_ptr(shared_ptr<Y>&& r, T* p) noexcept : shared_ptr() {
     r.swap(*this);
     ptr = p;
+    SHARED_PTR_TRACE_OP(control, move);
   }
 
   shared_ptr(const shared_ptr& r) noexcept : control(r.control), ptr(r.ptr) {
@@ -53,25 +99,30 @@ struct shared_ptr {
 
   shared_ptr(shared_ptr&& r) noexcept : shared_ptr() {
     r.swap(*this);
+    SHARED_PTR_TRACE_OP(control, move);
   }
 
+  // the deleter keeps its block when r is moved from or reset, so the block
+  // is only taken while r owns something
+  template <class Y>
+  shared_ptr(unique_shared_ptr<Y>&& r) noexcept : control(r ? r.get_deleter().control : nullptr), ptr(r.release()) {}
+
   template <class Y>
   explicit shared_ptr(const weak_ptr<Y>& r) : control(r.control), ptr(r.ptr) {
-    increase_control();
+    if (control != nullptr && !control->try_add_shared()) {
+#if SHARED_PTR_EXCEPTIONS
+      throw std::bad_weak_ptr();
+#else
+      control = nullptr;
+      ptr = nullptr;
+#endif
+    }
   }
 
   // destructor
   ~shared_ptr() {
-    if (control == nullptr) {
-      return;
-    }
-
-    control->shared_counter--;
-    if (control->shared_counter == 0) {
-      control->delete_object();
-      if (control->weak_counter == 0) {
-        delete control;
-      }
+    if (control != nullptr) {
+      control->release_shared();
     }
   }
 
@@ -117,6 +168,28 @@ struct shared_ptr {
     shared_ptr<T>(p, std::move(d)).swap(*this);
   }
 
+  // same as *this = make_shared<T>(args...), but when this is the only
+  // reference to a make_shared block the new T is built in the old storage.
+  // If that construction throws, *this is left empty
+  template <class... Args>
+  void reset_emplace(Args&&... args) {
+    if (!can_reuse_storage()) {
+      *this = make_shared<T>(std::forward<Args>(args)...);
+      return;
+    }
+
+    ptr->~T();
+    SHARED_PTR_TRY {
+      ::new (static_cast<void*>(const_cast<std::remove_cv_t<T>*>(ptr))) T(std::forward<Args>(args)...);
+    } SHARED_PTR_CATCH_ALL {
+      // the object is gone already, only the block has to be released
+      control->release_destroyed();
+      control = nullptr;
+      ptr = nullptr;
+      SHARED_PTR_RETHROW;
+    }
+  }
+
   void swap(shared_ptr& r) noexcept {
     std::swap(control, r.control);
     std::swap(ptr, r.ptr);
@@ -127,7 +200,8 @@ struct shared_ptr {
     return ptr;
   }
 
-  T& operator*() const noexcept {
+  // for shared_ptr<void> these are declared but cannot be used
+  std::add_lvalue_reference_t<T> operator*() const noexcept {
     return *ptr;
   }
 
@@ -135,12 +209,12 @@ struct shared_ptr {
     return ptr;
   }
 
-  T& operator[](std::ptrdiff_t idx) const {
+  std::add_lvalue_reference_t<T> operator[](std::ptrdiff_t idx) const {
     return ptr[idx];
   }
 
   size_t use_count() const noexcept {
-    return control == nullptr ? 0 : control->shared_counter;
+    return control == nullptr ? 0 : control->shared_counter.load(std::memory_order_relaxed);
   }
 
   explicit operator bool() const noexcept {
@@ -148,17 +222,52 @@ struct shared_ptr {
   }
 
  private:
+  // takes over a reference already accounted for in c->shared_counter
+  static shared_ptr adopt(control_block* c, T* p) noexcept {
+    shared_ptr result;
+    result.control = c;
+    result.ptr = p;
+    return result;
+  }
+
   void increase_control() {
     if (control != nullptr) {
-      control->shared_counter++;
+      control->add_shared();
     }
   }
 
+  bool can_reuse_storage() const noexcept {
+    return control != nullptr && typeid(*control) == typeid(init_block<T>) &&
+           ptr == static_cast<init_block<T>*>(control)->get() &&
+           control->shared_counter.load(std::memory_order_acquire) == 1 &&
+           control->weak_counter.load(std::memory_order_acquire) == 1 &&
+           control->expire_callbacks.load(std::memory_order_acquire) == nullptr;
+  }
+
 
   template <typename Y>
   friend class weak_ptr;
   template <typename Y>
   friend class shared_ptr;
+  template <typename Y>
+  friend struct weighted_ptr;
+  template <typename Y>
+  friend struct compact_weak_ptr;
+  template <typename Y>
+  friend struct atomic_shared_ptr;
+  friend struct ptr_access;
+  template <class Y, class Callback>
+  friend void on_expire(const shared_ptr<Y>& p, Callback&& callback);
+  template <class ...Ys, size_t ...I>
+  friend std::tuple<shared_ptr<Ys>...> adopt_group(group_block<Ys...>* block, std::index_sequence<I...>);
+  template <class Header, class Elem, class... Args>
+  friend struct shared_with_trailing<Header, Elem> make_shared_with_trailing(size_t n, Args&&... args);
+  template <class Y>
+  friend unique_shared_ptr<Y> try_take_unique(shared_ptr<Y>&& p) noexcept;
+  template <class Y, class... Args>
+  friend shared_ptr<Y> make_shared(Args&&... args);
+  template <class Y, class... Args>
+  friend shared_ptr<Y> try_make_shared(Args&&... args);
 
   control_block* control;
   T* ptr;
@@ -167,7 +276,93 @@ struct shared_ptr {
 // not member functions
 template <class T, class... Args>
 shared_ptr<T> make_shared(Args&&... args) {
-  return shared_ptr<T>(new T(std::forward<Args>(args)...));
+  auto* block = new_block<init_block<T>>(std::forward<Args>(args)...);
+  if (block == nullptr) {
+    report_allocation_failure();
+    return shared_ptr<T>();
+  }
+  block->add_shared();
+  return shared_ptr<T>::adopt(block, block->get());
+}
+
+// make_shared that returns an empty pointer if the allocation fails, in
+// either mode; exceptions from T's constructor still propagate
+template <class T, class... Args>
+shared_ptr<T> try_make_shared(Args&&... args) {
+  auto* block = new (std::nothrow) init_block<T>(std::forward<Args>(args)...);
+  if (block == nullptr) {
+    return shared_ptr<T>();
+  }
+  block->add_shared();
+  return shared_ptr<T>::adopt(block, block->get());
+}
+
+template <class... Ts, size_t... I>
+std::tuple<shared_ptr<Ts>...> adopt_group(group_block<Ts...>* block, std::index_sequence<I...>) {
+  return std::tuple<shared_ptr<Ts>...>(shared_ptr<Ts>::adopt(block, &group_get<I>(block->members()))...);
+}
+
+// constructs every Ts in one allocation sharing one pair of counters; each
+// Ts is built from the matching tuple of arguments, or value-initialized
+// when no tuples are given. Every returned pointer keeps the whole group alive
+template <class... Ts, class... Tuples>
+std::tuple<shared_ptr<Ts>...> make_shared_group(Tuples&&... args) {
+  static_assert(sizeof...(Tuples) == 0 || sizeof...(Tuples) == sizeof...(Ts),
+                "make_shared_group needs one argument tuple per sub-object");
+
+  auto* block = new_block<group_block<Ts...>>(std::forward<Tuples>(args)...);
+  if (block == nullptr) {
+    report_allocation_failure();
+    return std::tuple<shared_ptr<Ts>...>();
+  }
+  block->add_shared(sizeof...(Ts));
+  return adopt_group(block, std::index_sequence_for<Ts...>());
+}
+
+template <typename Header, typename Elem>
+struct shared_with_trailing {
+  shared_ptr<Header> header;
+  // valid for as long as header owns the object
+  std::span<Elem> trailing;
+};
+
+// places Header and n value-initialized Elems behind it in one allocation
+template <class Header, class Elem, class... Args>
+shared_with_trailing<Header, Elem> make_shared_with_trailing(size_t n, Args&&... args) {
+  auto* block = trailing_block<Header, Elem>::create(n, std::forward<Args>(args)...);
+  if (block == nullptr) {
+    report_allocation_failure();
+    return {};
+  }
+  block->add_shared();
+  return {shared_ptr<Header>::adopt(block, block->get_header()), std::span<Elem>(block->elements(), n)};
+}
+
+// if p is the only owner and nothing observes the object through a weak_ptr,
+// moves the ownership into the result, otherwise returns an empty handle and
+// leaves p untouched. The result converts back to shared_ptr without allocating.
+// An owning p that aliases a null pointer is left untouched too, since the
+// unique_ptr would never call its deleter
+template <class T>
+unique_shared_ptr<T> try_take_unique(shared_ptr<T>&& p) noexcept {
+  control_block* c = p.control;
+  if (c == nullptr || p.ptr == nullptr || c->shared_counter.load(std::memory_order_acquire) != 1 ||
+      c->weak_counter.load(std::memory_order_acquire) != 1) {
+    return unique_shared_ptr<T>();
+  }
+  unique_shared_ptr<T> result(p.ptr, control_block_deleter{c});
+  p.control = nullptr;
+  p.ptr = nullptr;
+  return result;
+}
+
+// callback runs once, after the object owned by p has been destroyed;
+// it must not throw. Does nothing for an empty p
+template <class T, class Callback>
+void on_expire(const shared_ptr<T>& p, Callback&& callback) {
+  if (p.control != nullptr) {
+    p.control->add_expire_callback(std::forward<Callback>(callback));
+  }
 }
 
 template <class T, class U>
@@ -222,22 +417,19 @@ struct weak_ptr {
 
   weak_ptr(weak_ptr&& r) noexcept : weak_ptr() {
     r.swap(*this);
+    SHARED_PTR_TRACE_OP(control, weak_move);
   }
 
   template <class Y>
   weak_ptr(weak_ptr<Y>&& r) noexcept : weak_ptr() {
     r.swap(*this);
+    SHARED_PTR_TRACE_OP(control, weak_move);
   }
 
   // destructor
   ~weak_ptr()  {
-    if (control == nullptr) {
-      return;
-    }
-
-    control->weak_counter--;
-    if (control->shared_counter == 0 && control->weak_counter == 0) {
-        delete control;
+    if (control != nullptr) {
+      control->release_weak();
     }
   }
 
@@ -272,11 +464,7 @@ struct weak_ptr {
 
   // modifiers
   void reset() noexcept {
-    if (control == nullptr) {
-      return;
-    }
-    control->weak_counter--;
-    control = nullptr;
+    weak_ptr().swap(*this);
   }
 
   void swap(weak_ptr& r) noexcept {
@@ -286,26 +474,46 @@ struct weak_ptr {
 
   // observers
   size_t use_count() const noexcept {
-    return control == nullptr ? 0 : control->shared_counter;
+    return control == nullptr ? 0 : control->shared_counter.load(std::memory_order_relaxed);
   }
 
   bool expired() const noexcept {
     return use_count() == 0;
   }
 
+  // blocks until the object expires; returns false if timeout passes first
+  template <class Rep, class Period>
+  bool wait_until_expired(const std::chrono::duration<Rep, Period>& timeout) const noexcept {
+    return control == nullptr || control->wait_until_expired(timeout);
+  }
+
   shared_ptr<T> lock() const noexcept {
-    return expired() ? shared_ptr<T>() : shared_ptr<T>(*this);
+    if (control == nullptr || !control->try_add_shared()) {
+      return shared_ptr<T>();
+    }
+    return shared_ptr<T>::adopt(control, ptr);
   }
 
  private:
+  // takes over a reference already accounted for in c->weak_counter
+  static weak_ptr adopt(control_block* c, T* p) noexcept {
+    weak_ptr result;
+    result.control = c;
+    result.ptr = p;
+    return result;
+  }
+
   void increase_control() {
     if (control != nullptr) {
-      control->weak_counter++;
+      control->add_weak();
     }
   }
 
   template <typename Y>
   friend class weak_ptr;
+  template <typename Y>
+  friend struct atomic_weak_ptr;
+  friend struct ptr_access;
 
   template <typename Y>
   friend class shared_ptr;
@@ -313,3 +521,27 @@ struct weak_ptr {
   control_block* control;
   T* ptr;
 };
+
+// lets algorithms over containers of pointers reach the control blocks
+struct ptr_access {
+  template <class T>
+  static control_block* control(const shared_ptr<T>& p) noexcept {
+    return p.control;
+  }
+
+  template <class T>
+  static control_block* control(const weak_ptr<T>& p) noexcept {
+    return p.control;
+  }
+
+  template <class T>
+  static T* get(const weak_ptr<T>& p) noexcept {
+    return p.ptr;
+  }
+
+  // takes over a reference already accounted for in c->shared_counter
+  template <class T>
+  static shared_ptr<T> adopt(control_block* c, T* p) noexcept {
+    return shared_ptr<T>::adopt(c, p);
+  }
+};
@@ -0,0 +1,277 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+#include <no_exceptions.h>
+
+// Shared ownership over objects stored contiguously. A slot_map keeps its
+// live objects densely packed in one vector, in no particular order, and a
+// shared_handle names one of them by a 32-bit slot index plus the slot's
+// generation instead of pointing at a heap control block. The strong counts
+// sit in an array parallel to the slots; weak_handles are not counted at
+// all, they compare their generation with the slot's, which is bumped
+// whenever the slot is freed. A weak_handle can thus only be fooled after
+// its slot has been reused 2^32 times.
+//
+// When the last shared_handle goes away the last object is moved into the
+// hole, so iteration never skips dead entries, and the slot goes back on a
+// free list. Objects must be move constructible and move assignable, and
+// they move when others are destroyed or added, so hold on to handles and
+// not to references.
+//
+// Unlike shared_ptr, a slot_map and its handles are not thread-safe: they
+// must be used by one thread at a time, and the map must outlive every
+// handle to it.
+
+template <typename T>
+struct slot_map;
+
+template <typename T>
+struct weak_handle;
+
+template <typename T>
+struct shared_handle {
+  // constructors
+  constexpr shared_handle() noexcept = default;
+
+  shared_handle(const shared_handle& r) noexcept : map(r.map), index(r.index), generation(r.generation) {
+    if (map != nullptr) {
+      map->add_shared(index);
+    }
+  }
+
+  shared_handle(shared_handle&& r) noexcept
+      : map(std::exchange(r.map, nullptr)), index(r.index), generation(r.generation) {}
+
+  // destructor
+  ~shared_handle() {
+    if (map != nullptr) {
+      map->release_shared(index);
+    }
+  }
+
+  // operator=
+  shared_handle& operator=(const shared_handle& r) noexcept {
+    shared_handle(r).swap(*this);
+    return *this;
+  }
+
+  shared_handle& operator=(shared_handle&& r) noexcept {
+    shared_handle(std::move(r)).swap(*this);
+    return *this;
+  }
+
+  // modifiers
+  void reset() noexcept {
+    shared_handle().swap(*this);
+  }
+
+  void swap(shared_handle& r) noexcept {
+    std::swap(map, r.map);
+    std::swap(index, r.index);
+    std::swap(generation, r.generation);
+  }
+
+  // observers
+
+  // valid until the next object of the map is added or destroyed
+  T* get() const noexcept {
+    return map == nullptr ? nullptr : map->object_at(index);
+  }
+
+  T& operator*() const noexcept {
+    return *get();
+  }
+
+  T* operator->() const noexcept {
+    return get();
+  }
+
+  size_t use_count() const noexcept {
+    return map == nullptr ? 0 : map->counts[index];
+  }
+
+  explicit operator bool() const noexcept {
+    return map != nullptr;
+  }
+
+  uint32_t slot() const noexcept {
+    return index;
+  }
+
+  bool operator==(const shared_handle& r) const noexcept {
+    return map == r.map && index == r.index && generation == r.generation;
+  }
+
+ private:
+  // takes over a count already accounted for in the map
+  shared_handle(slot_map<T>* m, uint32_t i, uint32_t g) noexcept : map(m), index(i), generation(g) {}
+
+  friend struct slot_map<T>;
+  friend struct weak_handle<T>;
+
+  slot_map<T>* map = nullptr;
+  uint32_t index = 0;
+  uint32_t generation = 0;
+};
+
+template <typename T>
+struct weak_handle {
+  // constructors
+  constexpr weak_handle() noexcept = default;
+
+  weak_handle(const shared_handle<T>& r) noexcept : map(r.map), index(r.index), generation(r.generation) {}
+
+  // modifiers
+  void reset() noexcept {
+    map = nullptr;
+  }
+
+  // observers
+  bool expired() const noexcept {
+    return map == nullptr || map->slots[index].generation != generation;
+  }
+
+  size_t use_count() const noexcept {
+    return expired() ? 0 : map->counts[index];
+  }
+
+  shared_handle<T> lock() const noexcept {
+    if (expired()) {
+      return shared_handle<T>();
+    }
+    map->add_shared(index);
+    return shared_handle<T>(map, index, generation);
+  }
+
+ private:
+  slot_map<T>* map = nullptr;
+  uint32_t index = 0;
+  uint32_t generation = 0;
+};
+
+template <typename T>
+struct slot_map {
+  // constructors
+  slot_map() = default;
+
+  slot_map(const slot_map&) = delete;
+  slot_map& operator=(const slot_map&) = delete;
+
+  // destructor
+  ~slot_map() {
+    assert(objects.empty() && "slot_map destroyed while shared_handles to it are alive");
+  }
+
+  // modifiers
+  // if constructing the object throws, the map is left as it was
+  template <class... Args>
+  shared_handle<T> emplace(Args&&... args) {
+    // room for everything is made first, so that after the slot is taken
+    // only the object's constructor can throw
+    reserve_one(objects);
+    reserve_one(owners);
+    uint32_t index;
+    if (free_slots.empty()) {
+      reserve_one(slots);
+      reserve_one(counts);
+      reserve_one(free_slots);
+      index = static_cast<uint32_t>(slots.size());
+      slots.push_back(slot{0, 0});
+      counts.push_back(0);
+    } else {
+      index = free_slots.back();
+      free_slots.pop_back();
+    }
+    SHARED_PTR_TRY {
+      objects.emplace_back(std::forward<Args>(args)...);
+    } SHARED_PTR_CATCH_ALL {
+      free_slots.push_back(index);
+      SHARED_PTR_RETHROW;
+    }
+    owners.push_back(index);
+    slots[index].dense = static_cast<uint32_t>(objects.size() - 1);
+    counts[index] = 1;
+    return shared_handle<T>(this, index, slots[index].generation);
+  }
+
+  void reserve(size_t n) {
+    objects.reserve(n);
+    owners.reserve(n);
+    slots.reserve(n);
+    counts.reserve(n);
+  }
+
+  // observers
+  size_t size() const noexcept {
+    return objects.size();
+  }
+
+  // the live objects, in storage order
+  std::span<T> values() noexcept {
+    return objects;
+  }
+
+  std::span<const T> values() const noexcept {
+    return objects;
+  }
+
+ private:
+  struct slot {
+    // position of the object in objects while the slot is in use
+    uint32_t dense;
+    uint32_t generation;
+  };
+
+  // grows v geometrically if it is full, so that the next push_back
+  // cannot throw
+  template <class U>
+  static void reserve_one(std::vector<U>& v) {
+    if (v.size() == v.capacity()) {
+      v.reserve(v.empty() ? 4 : 2 * v.size());
+    }
+  }
+
+  T* object_at(uint32_t index) noexcept {
+    return &objects[slots[index].dense];
+  }
+
+  void add_shared(uint32_t index) noexcept {
+    ++counts[index];
+  }
+
+  void release_shared(uint32_t index) noexcept {
+    if (--counts[index] != 0) {
+      return;
+    }
+    uint32_t dense = slots[index].dense;
+    // moved out first: its destructor runs once the map is consistent
+    // again, so it may release or create other handles to this map
+    [[maybe_unused]] T dead(std::move(objects[dense]));
+    uint32_t last = static_cast<uint32_t>(objects.size() - 1);
+    if (dense != last) {
+      objects[dense] = std::move(objects[last]);
+      owners[dense] = owners[last];
+      slots[owners[dense]].dense = dense;
+    }
+    objects.pop_back();
+    owners.pop_back();
+    ++slots[index].generation;
+    free_slots.push_back(index);
+  }
+
+  friend struct shared_handle<T>;
+  friend struct weak_handle<T>;
+
+  std::vector<T> objects;
+  // slot index of each object
+  std::vector<uint32_t> owners;
+  std::vector<slot> slots;
+  // strong counts, parallel to slots
+  std::vector<uint32_t> counts;
+  std::vector<uint32_t> free_slots;
+};
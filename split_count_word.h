@@ -0,0 +1,162 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <control_block.h>
+
+// The word behind atomic_shared_ptr and atomic_weak_ptr, split reference
+// counting over one kind of reference to a control block. The word packs
+// the block address with a count of loads in flight: a load first bumps that
+// count, which keeps the block alive while it takes a proper reference, and
+// then hands the borrowed unit back. Whoever replaces the word turns the
+// borrows still in flight into references, which the late loaders then
+// release.
+//
+// References is the kind of reference the word holds, with
+//   static void acquire(control_block*)            takes one
+//   static void adopt(control_block*, size_t n)    accounts for n borrows
+//   static void release(control_block*)            drops one
+template <typename References>
+struct split_count_word {
+  static_assert(sizeof(uintptr_t) == 8, "split_count_word needs 48-bit addresses in a 64-bit word");
+
+  static constexpr bool is_always_lock_free = std::atomic<uintptr_t>::is_always_lock_free;
+
+  // constructors
+  constexpr split_count_word() noexcept : word(0) {}
+
+  // takes over a reference to c
+  explicit split_count_word(control_block* c) noexcept : word(pack(c)) {}
+
+  split_count_word(const split_count_word&) = delete;
+  split_count_word& operator=(const split_count_word&) = delete;
+
+  // destructor
+  ~split_count_word() {
+    drop(word.load(std::memory_order_relaxed));
+  }
+
+  // operations
+
+  // the stored block with a new reference to it, or null
+  control_block* load() const noexcept {
+    if (control_of(word.load(std::memory_order_relaxed)) == nullptr) {
+      return nullptr;
+    }
+
+    control_block* c = control_of(word.fetch_add(one_borrow, std::memory_order_acquire));
+    if (c == nullptr) {
+      return_borrow(c);
+      return nullptr;
+    }
+    References::acquire(c);
+    return_borrow(c);
+    return c;
+  }
+
+  // stores c, taking over its reference, and drops the old one
+  void store(control_block* c) noexcept {
+    drop(word.exchange(pack(c), std::memory_order_acq_rel));
+  }
+
+  // stores c, taking over its reference, and hands the old block and its
+  // reference to the caller
+  control_block* exchange(control_block* c) noexcept {
+    uintptr_t old = word.exchange(pack(c), std::memory_order_acq_rel);
+    control_block* previous = control_of(old);
+    if (previous != nullptr) {
+      References::adopt(previous, borrows_of(old));
+    }
+    return previous;
+  }
+
+  // stores desired if expected is stored, taking over the reference of
+  // desired; on failure that reference is dropped
+  bool compare_exchange(control_block* expected, control_block* desired) noexcept {
+    uintptr_t current = word.load(std::memory_order_relaxed);
+    uintptr_t next = pack(desired);
+    while (control_of(current) == expected) {
+      if (word.compare_exchange_weak(current, next, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+        drop(current);
+        return true;
+      }
+    }
+    drop(next);
+    return false;
+  }
+
+ private:
+  static constexpr unsigned borrow_shift = 48;
+  static constexpr uintptr_t one_borrow = uintptr_t(1) << borrow_shift;
+  static constexpr uintptr_t address_mask = one_borrow - 1;
+
+  static control_block* control_of(uintptr_t w) noexcept {
+    return reinterpret_cast<control_block*>(w & address_mask);
+  }
+
+  static size_t borrows_of(uintptr_t w) noexcept {
+    return static_cast<size_t>(w >> borrow_shift);
+  }
+
+  static uintptr_t pack(control_block* c) noexcept {
+    return reinterpret_cast<uintptr_t>(c);
+  }
+
+  // drops the reference held by a word that has just been replaced
+  static void drop(uintptr_t old) noexcept {
+    control_block* c = control_of(old);
+    if (c == nullptr) {
+      return;
+    }
+    size_t borrows = borrows_of(old);
+    if (borrows != 0) {
+      References::adopt(c, borrows);
+    }
+    References::release(c);
+  }
+
+  void return_borrow(control_block* c) const noexcept {
+    uintptr_t current = word.load(std::memory_order_relaxed);
+    while (control_of(current) == c && borrows_of(current) != 0) {
+      if (word.compare_exchange_weak(current, current - one_borrow, std::memory_order_release,
+                                     std::memory_order_relaxed)) {
+        return;
+      }
+    }
+    // the word was replaced, our borrow became a reference
+    if (c != nullptr) {
+      References::release(c);
+    }
+  }
+
+  mutable std::atomic<uintptr_t> word;
+};
+
+struct shared_references {
+  static void acquire(control_block* c) noexcept {
+    c->add_shared();
+  }
+
+  static void adopt(control_block* c, size_t n) noexcept {
+    c->shared_counter.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  static void release(control_block* c) noexcept {
+    c->release_shared();
+  }
+};
+
+struct weak_references {
+  static void acquire(control_block* c) noexcept {
+    c->add_weak();
+  }
+
+  static void adopt(control_block* c, size_t n) noexcept {
+    c->weak_counter.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  static void release(control_block* c) noexcept {
+    c->release_weak();
+  }
+};
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <no_exceptions.h>
+
+// Recording of reference count operations, to be replayed by shared_ptr_replay.
+// In builds with SHARED_PTR_TRACE defined every control block gets an id and
+// reports its counter operations here; between trace_recorder::start() and
+// stop() they are appended to a buffer of the calling thread, which is written
+// out a chunk at a time, so recording threads only meet when they flush.
+//
+// The file starts with trace_magic, followed by chunks of
+// {uint32 thread, uint32 count} and count 64-bit records, each holding the
+// block id above the trace_op in the low byte. Records of one thread keep
+// their order; records of different threads are not ordered. A batched
+// counter update such as add_shared(n) is recorded once.
+
+enum class trace_op : uint8_t {
+  create,          // control block constructed
+  add_shared,
+  release_shared,
+  add_weak,
+  release_weak,
+  lock,            // weak to strong conversion that succeeded
+  lock_failed,
+  move,            // shared_ptr moved, counters untouched
+  weak_move,
+};
+
+struct trace_record {
+  uint64_t word;
+
+  uint64_t block() const noexcept {
+    return word >> 8;
+  }
+
+  trace_op op() const noexcept {
+    return static_cast<trace_op>(word & 0xFF);
+  }
+};
+
+struct trace_thread_log {
+  uint32_t thread;
+  std::vector<trace_record> records;
+};
+
+constexpr char trace_magic[8] = {'s', 'p', 't', 'r', 'a', 'c', 'e', '1'};
+
+struct trace_recorder {
+  static constexpr size_t chunk_records = size_t(1) << 16;
+
+  // starts recording into path, returns false if it cannot be opened
+  static bool start(const char* path) {
+    sink& s = instance();
+    std::lock_guard<std::mutex> guard(s.lock);
+    if (s.file != nullptr) {
+      return false;
+    }
+    s.file = std::fopen(path, "wb");
+    if (s.file == nullptr) {
+      return false;
+    }
+    std::fwrite(trace_magic, 1, sizeof(trace_magic), s.file);
+    s.session.fetch_add(1, std::memory_order_relaxed);
+    s.active.store(true, std::memory_order_release);
+    return true;
+  }
+
+  // Stops recording and closes the file. Only the calling thread's buffer is
+  // flushed here; other recording threads must have exited or called flush()
+  static void stop() {
+    sink& s = instance();
+    s.active.store(false, std::memory_order_relaxed);
+    thread_buffer& b = local_buffer();
+    flush(b);
+    std::vector<uint64_t>().swap(b.records);
+
+    std::lock_guard<std::mutex> guard(s.lock);
+    if (s.file != nullptr) {
+      std::fclose(s.file);
+      s.file = nullptr;
+    }
+  }
+
+  // writes out what the calling thread has recorded so far
+  static void flush() {
+    flush(local_buffer());
+  }
+
+  static void record(uint64_t block, trace_op op) noexcept {
+    sink& s = instance();
+    if (!s.active.load(std::memory_order_relaxed)) {
+      return;
+    }
+    thread_buffer& b = local_buffer();
+    uint32_t session = s.session.load(std::memory_order_relaxed);
+    if (b.session != session) {
+      b.records.clear();
+      b.session = session;
+    }
+    if (b.records.capacity() < chunk_records) {
+      SHARED_PTR_TRY {
+        b.records.reserve(chunk_records);
+      } SHARED_PTR_CATCH_ALL {
+        return;
+      }
+    }
+    b.records.push_back(block << 8 | static_cast<uint64_t>(op));
+    if (b.records.size() == chunk_records) {
+      flush(b);
+    }
+  }
+
+  static uint64_t next_block_id() noexcept {
+    return instance().next_block.fetch_add(1, std::memory_order_relaxed);
+  }
+
+ private:
+  struct sink {
+    std::mutex lock;
+    std::FILE* file = nullptr;
+    std::atomic<bool> active{false};
+    std::atomic<uint32_t> session{0};
+    std::atomic<uint32_t> next_thread{0};
+    std::atomic<uint64_t> next_block{1};
+  };
+
+  struct thread_buffer {
+    uint32_t thread = instance().next_thread.fetch_add(1, std::memory_order_relaxed);
+    uint32_t session = 0;
+    std::vector<uint64_t> records;
+
+    ~thread_buffer() {
+      flush(*this);
+    }
+  };
+
+  static sink& instance() {
+    static sink s;
+    return s;
+  }
+
+  static thread_buffer& local_buffer() {
+    thread_local thread_buffer b;
+    return b;
+  }
+
+  static void flush(thread_buffer& b) noexcept {
+    if (b.records.empty()) {
+      return;
+    }
+    sink& s = instance();
+    {
+      std::lock_guard<std::mutex> guard(s.lock);
+      if (s.file != nullptr && b.session == s.session.load(std::memory_order_relaxed)) {
+        uint32_t header[2] = {b.thread, static_cast<uint32_t>(b.records.size())};
+        std::fwrite(header, sizeof(header), 1, s.file);
+        std::fwrite(b.records.data(), sizeof(uint64_t), b.records.size(), s.file);
+      }
+    }
+    b.records.clear();
+  }
+};
+
+#if SHARED_PTR_HAS_EXCEPTIONS
+// reads a trace written by trace_recorder, one log per recorded thread in
+// the order they first appear; throws std::runtime_error on malformed input
+inline std::vector<trace_thread_log> read_trace(const char* path) {
+  std::FILE* file = std::fopen(path, "rb");
+  if (file == nullptr) {
+    throw std::runtime_error(std::string("cannot open trace ") + path);
+  }
+
+  std::vector<trace_thread_log> logs;
+  std::unordered_map<uint32_t, size_t> index;
+  char magic[sizeof(trace_magic)];
+  bool valid = std::fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+               std::memcmp(magic, trace_magic, sizeof(magic)) == 0;
+  uint32_t header[2];
+  while (valid && std::fread(header, sizeof(header), 1, file) == 1) {
+    auto [it, inserted] = index.try_emplace(header[0], logs.size());
+    if (inserted) {
+      logs.push_back({header[0], {}});
+    }
+    std::vector<trace_record>& records = logs[it->second].records;
+    size_t offset = records.size();
+    records.resize(offset + header[1]);
+    valid = std::fread(records.data() + offset, sizeof(trace_record), header[1], file) == header[1];
+  }
+  valid = valid && std::feof(file);
+  std::fclose(file);
+  if (!valid) {
+    throw std::runtime_error(std::string("malformed trace ") + path);
+  }
+  return logs;
+}
+#endif
+
+#if defined(SHARED_PTR_TRACE)
+template <class Block>
+void trace_block_op(Block* block, trace_op op) noexcept {
+  if (block != nullptr) {
+    trace_recorder::record(block->trace_id, op);
+  }
+}
+
+#define SHARED_PTR_TRACE_OP(block, op) trace_block_op((block), trace_op::op)
+#else
+#define SHARED_PTR_TRACE_OP(block, op) ((void)0)
+#endif
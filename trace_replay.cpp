@@ -0,0 +1,331 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <latch>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "shared_ptr.h"
+#include "trace_recorder.h"
+
+// Replays a trace recorded with SHARED_PTR_TRACE against several pointer
+// implementations, one thread per recorded thread.
+//
+// Per-thread order is all a trace keeps, so each thread replays its own
+// records on handles of its own. When a thread works on a block it got from
+// another thread, or releases more references than it took, it gets the
+// missing handles before the clock starts; such blocks are also kept alive by
+// the replayer for the whole run so the threads can touch them in any order.
+// The remaining blocks are created and destroyed inside the measurement.
+
+namespace
+{
+    struct replay_object
+    {
+        uint64_t words[4] = {};
+    };
+
+    struct replay_op
+    {
+        uint32_t slot;
+        trace_op op;
+    };
+
+    // a block as seen by one thread
+    struct replay_slot
+    {
+        uint32_t block;
+        uint32_t strong_stock = 0;
+        uint32_t weak_stock = 0;
+        uint32_t strong_depth = 0;
+        uint32_t weak_depth = 0;
+    };
+
+    struct thread_plan
+    {
+        std::vector<replay_slot> slots;
+        std::vector<replay_op> ops;
+    };
+
+    struct replay_plan
+    {
+        std::vector<bool> seeded;
+        std::vector<thread_plan> threads;
+        size_t operations = 0;
+    };
+
+    replay_plan plan_replay(std::vector<trace_thread_log> const& logs)
+    {
+        replay_plan plan;
+        std::unordered_map<uint64_t, uint32_t> blocks;
+        std::vector<uint32_t> owners;
+
+        for (auto const& log : logs)
+        {
+            thread_plan tp;
+            std::unordered_map<uint32_t, uint32_t> slots;
+            std::vector<bool> fresh;
+            // live handles of each slot while walking the log
+            std::vector<uint32_t> strong;
+            std::vector<uint32_t> weak;
+
+            for (trace_record r : log.records)
+            {
+                auto [b, new_block] = blocks.try_emplace(r.block(), static_cast<uint32_t>(owners.size()));
+                if (new_block)
+                {
+                    owners.push_back(static_cast<uint32_t>(plan.threads.size()));
+                    plan.seeded.push_back(false);
+                }
+                else if (owners[b->second] != plan.threads.size())
+                {
+                    plan.seeded[b->second] = true;
+                }
+
+                auto [s, new_slot] = slots.try_emplace(b->second, static_cast<uint32_t>(tp.slots.size()));
+                uint32_t slot = s->second;
+                if (new_slot)
+                {
+                    tp.slots.push_back({b->second});
+                    fresh.push_back(false);
+                    strong.push_back(0);
+                    weak.push_back(0);
+                }
+                replay_slot& rs = tp.slots[slot];
+                auto need_strong = [&] {
+                    if (strong[slot] == 0)
+                    {
+                        ++rs.strong_stock;
+                        ++strong[slot];
+                    }
+                };
+                auto need_weak = [&] {
+                    if (weak[slot] == 0)
+                    {
+                        ++rs.weak_stock;
+                        ++weak[slot];
+                    }
+                };
+
+                trace_op op = r.op();
+                switch (op)
+                {
+                case trace_op::create:
+                    // becomes a make_shared together with the first add_shared
+                    fresh[slot] = true;
+                    continue;
+                case trace_op::add_shared:
+                    if (fresh[slot])
+                    {
+                        fresh[slot] = false;
+                        op = trace_op::create;
+                    }
+                    else
+                    {
+                        need_strong();
+                    }
+                    ++strong[slot];
+                    break;
+                case trace_op::release_shared:
+                    need_strong();
+                    --strong[slot];
+                    break;
+                case trace_op::add_weak:
+                    if (strong[slot] == 0)
+                        need_weak();
+                    ++weak[slot];
+                    break;
+                case trace_op::release_weak:
+                    need_weak();
+                    --weak[slot];
+                    break;
+                case trace_op::lock:
+                    need_weak();
+                    ++strong[slot];
+                    break;
+                case trace_op::lock_failed:
+                    need_weak();
+                    break;
+                case trace_op::move:
+                    if (strong[slot] == 0)
+                        continue;
+                    break;
+                case trace_op::weak_move:
+                    if (weak[slot] == 0)
+                        continue;
+                    break;
+                default:
+                    continue;
+                }
+                rs.strong_depth = std::max(rs.strong_depth, strong[slot]);
+                rs.weak_depth = std::max(rs.weak_depth, weak[slot]);
+                tp.ops.push_back({slot, op});
+            }
+
+            for (auto const& rs : tp.slots)
+            {
+                if (rs.strong_stock != 0 || rs.weak_stock != 0)
+                    plan.seeded[rs.block] = true;
+            }
+            plan.operations += tp.ops.size();
+            plan.threads.push_back(std::move(tp));
+        }
+        return plan;
+    }
+
+    template <class Shared, class Weak, class Make>
+    double replay(replay_plan const& plan, Make make)
+    {
+        std::vector<Shared> seeds(plan.seeded.size());
+        for (size_t i = 0; i != seeds.size(); ++i)
+        {
+            if (plan.seeded[i])
+                seeds[i] = make();
+        }
+
+        struct thread_state
+        {
+            std::vector<std::vector<Shared>> strong;
+            std::vector<std::vector<Weak>> weak;
+        };
+        std::vector<thread_state> states(plan.threads.size());
+        for (size_t t = 0; t != plan.threads.size(); ++t)
+        {
+            auto const& slots = plan.threads[t].slots;
+            states[t].strong.resize(slots.size());
+            states[t].weak.resize(slots.size());
+            for (size_t i = 0; i != slots.size(); ++i)
+            {
+                auto& strong = states[t].strong[i];
+                auto& weak = states[t].weak[i];
+                strong.reserve(slots[i].strong_depth);
+                weak.reserve(slots[i].weak_depth);
+                for (uint32_t k = 0; k != slots[i].strong_stock; ++k)
+                    strong.push_back(seeds[slots[i].block]);
+                for (uint32_t k = 0; k != slots[i].weak_stock; ++k)
+                    weak.push_back(seeds[slots[i].block]);
+            }
+        }
+
+        auto run = [&](size_t t) {
+            thread_plan const& tp = plan.threads[t];
+            thread_state& state = states[t];
+            for (replay_op op : tp.ops)
+            {
+                auto& strong = state.strong[op.slot];
+                auto& weak = state.weak[op.slot];
+                switch (op.op)
+                {
+                case trace_op::create:
+                {
+                    uint32_t block = tp.slots[op.slot].block;
+                    strong.push_back(plan.seeded[block] ? seeds[block] : make());
+                    break;
+                }
+                case trace_op::add_shared:
+                    if (!strong.empty())
+                        strong.push_back(strong.back());
+                    break;
+                case trace_op::release_shared:
+                    if (!strong.empty())
+                        strong.pop_back();
+                    break;
+                case trace_op::add_weak:
+                    if (!weak.empty())
+                        weak.push_back(weak.back());
+                    else if (!strong.empty())
+                        weak.push_back(Weak(strong.back()));
+                    break;
+                case trace_op::release_weak:
+                    if (!weak.empty())
+                        weak.pop_back();
+                    break;
+                case trace_op::lock:
+                    if (!weak.empty())
+                    {
+                        if (Shared p = weak.back().lock())
+                            strong.push_back(std::move(p));
+                    }
+                    break;
+                case trace_op::lock_failed:
+                    if (!weak.empty())
+                        (void)weak.back().lock();
+                    break;
+                case trace_op::move:
+                    if (!strong.empty())
+                    {
+                        Shared p = std::move(strong.back());
+                        strong.back() = std::move(p);
+                    }
+                    break;
+                case trace_op::weak_move:
+                    if (!weak.empty())
+                    {
+                        Weak w = std::move(weak.back());
+                        weak.back() = std::move(w);
+                    }
+                    break;
+                }
+            }
+        };
+
+        std::latch ready(static_cast<std::ptrdiff_t>(plan.threads.size()) + 1);
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t != plan.threads.size(); ++t)
+        {
+            threads.emplace_back([&, t] {
+                ready.arrive_and_wait();
+                run(t);
+            });
+        }
+        ready.arrive_and_wait();
+        auto start = std::chrono::steady_clock::now();
+        for (auto& t : threads)
+            t.join();
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        return elapsed.count();
+    }
+
+    void report(char const* name, double nanoseconds, size_t operations)
+    {
+        std::printf("%-48s %10.2f ns/op\n", name, operations == 0 ? 0.0 : nanoseconds / operations);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 2)
+    {
+        std::fprintf(stderr, "usage: %s <trace>\n", argv[0]);
+        return 2;
+    }
+
+    replay_plan plan;
+    try
+    {
+        plan = plan_replay(read_trace(argv[1]));
+    }
+    catch (std::exception const& e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    std::printf("%zu threads, %zu blocks, %zu operations\n", plan.threads.size(), plan.seeded.size(), plan.operations);
+
+    report("replay/shared_ptr/make_shared",
+           replay<shared_ptr<replay_object>, weak_ptr<replay_object>>(plan, [] { return make_shared<replay_object>(); }),
+           plan.operations);
+    report("replay/shared_ptr/new",
+           replay<shared_ptr<replay_object>, weak_ptr<replay_object>>(plan, [] { return shared_ptr<replay_object>(new replay_object); }),
+           plan.operations);
+    report("replay/std::shared_ptr/make_shared",
+           replay<std::shared_ptr<replay_object>, std::weak_ptr<replay_object>>(plan, [] { return std::make_shared<replay_object>(); }),
+           plan.operations);
+    report("replay/std::shared_ptr/new",
+           replay<std::shared_ptr<replay_object>, std::weak_ptr<replay_object>>(plan, [] { return std::shared_ptr<replay_object>(new replay_object); }),
+           plan.operations);
+    return 0;
+}
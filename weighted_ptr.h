@@ -0,0 +1,141 @@
+#pragma once
+
+#include <shared_ptr.h>
+
+// Owner that holds `weight` units of control->shared_counter instead of one.
+// Copying splits the weight between source and copy without touching the
+// control block, so a copy can be handed to another thread for free; the
+// block is only written when the weight is returned on destruction or when a
+// handle with weight 1 has to be refilled.
+//
+// Since copying and share() change the weight of the source, they take a
+// non-const handle, and a handle, like any other object, must not be
+// modified by two threads at once: each thread copies from its own handle.
+template <typename T>
+struct weighted_ptr {
+  static constexpr size_t refill_weight = size_t(1) << 16;
+
+  // constructors
+  constexpr weighted_ptr() noexcept : control(nullptr), ptr(nullptr), weight(0) {}
+
+  constexpr weighted_ptr(std::nullptr_t) noexcept : weighted_ptr() {}
+
+  template <class Y>
+  explicit weighted_ptr(const shared_ptr<Y>& r) noexcept : control(r.control), ptr(r.ptr), weight(0) {
+    if (control != nullptr) {
+      control->add_shared(refill_weight);
+      weight = refill_weight;
+    }
+  }
+
+  template <class Y>
+  explicit weighted_ptr(shared_ptr<Y>&& r) noexcept : control(r.control), ptr(r.ptr), weight(0) {
+    if (control != nullptr) {
+      weight = 1;
+    }
+    r.control = nullptr;
+    r.ptr = nullptr;
+  }
+
+  weighted_ptr(weighted_ptr& r) noexcept : control(r.control), ptr(r.ptr), weight(r.split()) {}
+
+  weighted_ptr(const weighted_ptr&) = delete;
+
+  weighted_ptr(weighted_ptr&& r) noexcept : weighted_ptr() {
+    r.swap(*this);
+  }
+
+  // destructor
+  ~weighted_ptr() {
+    if (control != nullptr) {
+      control->release_shared(weight);
+    }
+  }
+
+  // operator=
+  weighted_ptr& operator=(weighted_ptr& r) noexcept {
+    weighted_ptr(r).swap(*this);
+    return *this;
+  }
+
+  weighted_ptr& operator=(const weighted_ptr&) = delete;
+
+  weighted_ptr& operator=(weighted_ptr&& r) noexcept {
+    weighted_ptr(std::move(r)).swap(*this);
+    return *this;
+  }
+
+  // modifiers
+  void reset() noexcept {
+    weighted_ptr().swap(*this);
+  }
+
+  void swap(weighted_ptr& r) noexcept {
+    std::swap(control, r.control);
+    std::swap(ptr, r.ptr);
+    std::swap(weight, r.weight);
+  }
+
+  // hands one unit of weight to an ordinary shared_ptr
+  shared_ptr<T> share() noexcept {
+    if (control == nullptr) {
+      return shared_ptr<T>();
+    }
+    refill_if_exhausted();
+    weight--;
+    return shared_ptr<T>::adopt(control, ptr);
+  }
+
+  // observers
+  T* get() const noexcept {
+    return ptr;
+  }
+
+  T& operator*() const noexcept {
+    return *ptr;
+  }
+
+  T* operator->() const noexcept {
+    return ptr;
+  }
+
+  size_t get_weight() const noexcept {
+    return weight;
+  }
+
+  explicit operator bool() const noexcept {
+    return ptr != nullptr;
+  }
+
+ private:
+  void refill_if_exhausted() noexcept {
+    if (weight == 1) {
+      control->add_shared(refill_weight);
+      weight += refill_weight;
+    }
+  }
+
+  size_t split() noexcept {
+    if (control == nullptr) {
+      return 0;
+    }
+    refill_if_exhausted();
+    size_t half = weight / 2;
+    weight -= half;
+    return half;
+  }
+
+  control_block* control;
+  T* ptr;
+  size_t weight;
+};
+
+template <class T, class U>
+bool operator==(const weighted_ptr<T>& lhs, const weighted_ptr<U>& rhs) noexcept {
+  return lhs.get() == rhs.get();
+}
+
+template <class T, class U>
+bool operator!=(const weighted_ptr<T>& lhs, const weighted_ptr<U>& rhs) noexcept {
+  return !(lhs == rhs);
+}